@@ -0,0 +1,285 @@
+/* engine benchmarks. Every workload is parsed and run a few
+ * times at a few input sizes, and its steps/s is compared
+ * with a baseline:
+ *   bench [--reps N] [--tolerance F] [--update] <baseline>
+ * exits 1 if a workload got slower than its baseline by more
+ * than the tolerance, or takes another number of steps. The
+ * best rep is compared, it is the least disturbed by other
+ * load on the host. Baselines only hold for the host they
+ * were measured on, with --update the baseline is written
+ * instead, and without one there is nothing to compare */
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define main turing_main
+#include "../main.cc"
+#undef main
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+static double secondsSince(Clock::time_point t) {
+  return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+static std::string readFile(const char *path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+static std::string machine(const char *states,
+    const char *symbols, const char *delta) {
+  return formatv("#Q = {%s}\n#S = {%s}\n#G = {%s,_}\n"
+                 "#q0 = a\n#B = _\n#F = {h}\n#N = 1\n\n%s",
+      states, symbols, symbols, delta);
+}
+
+/* palindrome of n symbols from ab */
+static std::string palindrome(size_t n, char a, char b) {
+  std::string s(n, a);
+  for (size_t i = 0; i < n / 2; i++)
+    if (i % 3 == 1) s[i] = s[n - 1 - i] = b;
+  return s;
+}
+
+struct Workload {
+  std::string name;
+  std::string program;
+  std::string input;
+  opt::TapeKind tape;
+  uint64_t maxSteps; // 0 for a run to the end
+};
+
+static std::vector<Workload> workloads() {
+  std::string case1 = readFile("programs/case1.tm");
+  std::string case2 = readFile("programs/case2.tm");
+  std::string pal = readFile("test/palindrome_detector_2tapes.tm");
+  /* sweeps back and forth over a growing block of 1s */
+  std::string sweep = machine("a,b,h", "1",
+      "a 1 1 r a\na _ 1 l b\nb 1 1 l b\nb _ _ r a\n");
+  /* binary counter counting up forever */
+  std::string counter = machine("a,i,h", "0,1",
+      "a 0 0 r a\na 1 1 r a\na _ _ l i\n"
+      "i 1 0 l i\ni 0 1 r a\ni _ 1 r a\n");
+
+  /* every program at sizes 16 times apart, so that engines
+   * can be compared as inputs and runs grow */
+  using opt::TAPE_FLAT, opt::TAPE_RLE, opt::TAPE_PACKED;
+  std::vector<Workload> ws;
+  for (auto [n, size] : {std::pair(1 << 14, "16k"),
+           std::pair(1 << 18, "256k"), std::pair(1 << 22, "4m")})
+    ws.push_back({formatv("case1-%s", size), case1,
+        palindrome(n, 'a', 'b'), TAPE_FLAT, 0});
+  for (size_t n : {125, 500, 2000}) {
+    std::string ones(n, '1');
+    ws.push_back({formatv("case2-%sx%s", n, n), case2,
+        ones + "x" + ones + "=" + std::string(n * n, '1'),
+        TAPE_FLAT, 0});
+  }
+  for (auto [n, size] : {std::pair(1 << 14, "16k"),
+           std::pair(1 << 18, "256k"), std::pair(1 << 22, "4m")})
+    ws.push_back({formatv("palindrome-%s", size), pal,
+        palindrome(n, '0', '1'), TAPE_FLAT, 0});
+  for (auto [n, size] : {std::pair(8000000, "8m"),
+           std::pair(125000000, "125m"),
+           std::pair(2000000000, "2g")})
+    ws.push_back({formatv("sweep-%s", size), sweep, "",
+        TAPE_FLAT, uint64_t(n)});
+  for (auto [n, size] : {std::pair(16000000000, "16g"),
+           std::pair(250000000000, "250g"),
+           std::pair(4000000000000, "4t")})
+    ws.push_back({formatv("sweep-rle-%s", size), sweep, "",
+        TAPE_RLE, uint64_t(n)});
+  for (auto [n, size] : {std::pair(80000, "80k"),
+           std::pair(1250000, "1250k"),
+           std::pair(20000000, "20m")}) {
+    ws.push_back({formatv("counter-%s", size), counter, "0",
+        TAPE_FLAT, uint64_t(n)});
+    ws.push_back({formatv("counter-packed-%s", size), counter,
+        "0", TAPE_PACKED, uint64_t(n)});
+  }
+  return ws;
+}
+
+struct Result {
+  double parseMs = 0;
+  double rate = 0, ci = 0; // steps/s, 95% half width
+  double best = 0;
+  uint64_t steps = 0;
+  size_t tapeBytes = 0;
+};
+
+/* two-sided 95% quantile of Student's t with df degrees of
+ * freedom */
+static double t95(unsigned df) {
+  static const double t[] = {0, 12.71, 4.303, 3.182, 2.776,
+      2.571, 2.447, 2.365, 2.306, 2.262, 2.228};
+  return df < 11 ? t[df] : 1.96;
+}
+
+template <class TapeT>
+static Result measure(const Workload &w, unsigned reps) {
+  Result r;
+  std::shared_ptr<const Program> prog;
+  std::vector<double> parses, rates;
+  for (unsigned k = 0; k < reps; k++) {
+    std::istringstream is(w.program);
+    TMParser parser;
+    Clock::time_point t0 = Clock::now();
+    prog = parser.parseProgram(is);
+    parses.push_back(secondsSince(t0) * 1e3);
+  }
+
+  /* rep 0 warms up caches and tape buffers, it is not
+   * counted */
+  BasicTuringMachine<TapeT> TM(prog);
+  opt::max_steps = w.maxSteps;
+  for (unsigned k = 0; k <= reps; k++) {
+    TM.reset();
+    TM.set_input(w.input);
+    Clock::time_point t0 = Clock::now();
+    TM.run();
+    double s = secondsSince(t0);
+    r.steps = TM.get_steps();
+    if (k) rates.push_back(r.steps / std::max(s, 1e-9));
+    r.tapeBytes = std::max(r.tapeBytes, TM.tapeMemory());
+  }
+  opt::max_steps = 0;
+
+  std::sort(parses.begin(), parses.end());
+  r.parseMs = parses[parses.size() / 2];
+  for (double x : rates) r.rate += x / reps;
+  r.best = *std::max_element(rates.begin(), rates.end());
+  double var = 0;
+  for (double x : rates) var += (x - r.rate) * (x - r.rate);
+  if (reps > 1)
+    r.ci = t95(reps - 1) * std::sqrt(var / (reps - 1) / reps);
+  return r;
+}
+
+static Result measure(const Workload &w, unsigned reps) {
+  switch (w.tape) {
+  case opt::TAPE_RLE: return measure<RleTape>(w, reps);
+  case opt::TAPE_PAGED: return measure<PagedTape>(w, reps);
+  case opt::TAPE_PACKED: return measure<PackedTape>(w, reps);
+  default: return measure<Tape>(w, reps);
+  }
+}
+
+/* value of key in the object of workload name, which is
+ * written by writeBaseline() */
+static bool lookup(const std::string &json,
+    const std::string &name, const char *key, double &v) {
+  size_t p = json.find("\"" + name + "\"");
+  if (p == std::string::npos) return false;
+  size_t e = json.find('}', p);
+  p = json.find(formatv("\"%s\":", key), p);
+  if (p == std::string::npos || p > e) return false;
+  v = strtod(json.c_str() + p + strlen(key) + 3, nullptr);
+  return true;
+}
+
+static bool writeBaseline(const char *path,
+    const std::vector<Workload> &ws,
+    const std::vector<Result> &rs) {
+  std::ofstream os(path);
+  os << "{";
+  for (size_t i = 0; i < ws.size(); i++) {
+    const Result &r = rs[i];
+    os << (i ? ",\n" : "\n") << "  \"" << ws[i].name << "\": {"
+       << "\"steps\": " << r.steps
+       << ", \"steps_per_sec\": " << uint64_t(r.rate)
+       << ", \"best_steps_per_sec\": " << uint64_t(r.best)
+       << ", \"ns_per_step\": " << 1e9 / r.rate
+       << ", \"parse_ms\": " << r.parseMs
+       << ", \"tape_bytes\": " << r.tapeBytes << "}";
+  }
+  os << "\n}\n";
+  return bool(os.flush());
+}
+
+static int run(int argc, const char *argv[]) {
+  unsigned reps = 5;
+  double tolerance = 0.2;
+  bool update = false;
+  const char *baseline = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+      reps = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--tolerance") == 0 &&
+               i + 1 < argc) {
+      tolerance = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--update") == 0) {
+      update = true;
+    } else {
+      baseline = argv[i];
+    }
+  }
+  if (!baseline) {
+    std::cout << "usage: bench [--reps N] [--tolerance F] "
+                 "[--update] <baseline>\n";
+    return 1;
+  }
+
+  std::string json = update ? "" : readFile(baseline);
+  std::vector<Workload> ws = workloads();
+  std::vector<Result> rs;
+  int failed = 0;
+
+  printf("%-20s %9s %23s %9s %10s %14s\n", "workload",
+      "parse ms", "Msteps/s (95% ci)", "ns/step", "tape KiB",
+      "baseline");
+  for (const Workload &w : ws) {
+    Result r = measure(w, reps);
+    rs.push_back(r);
+
+    std::string vs = "-";
+    double base = 0, steps = 0;
+    if (lookup(json, w.name, "best_steps_per_sec", base) &&
+        lookup(json, w.name, "steps", steps)) {
+      char delta[32];
+      snprintf(delta, sizeof(delta), "%+.1f%%",
+          100.0 * (r.best / base - 1));
+      vs = delta;
+      if (uint64_t(steps) != r.steps) {
+        vs = "steps changed";
+        failed = 1;
+      } else if (r.best < base * (1 - tolerance)) {
+        vs += " SLOWER";
+        failed = 1;
+      }
+    }
+    printf("%-20s %9.3f %11.1f +- %-8.1f %9.2f %10zu %14s\n",
+        w.name.c_str(), r.parseMs, r.rate / 1e6, r.ci / 1e6,
+        1e9 / r.rate, r.tapeBytes / 1024, vs.c_str());
+    fflush(stdout);
+  }
+
+  if (update) {
+    if (!writeBaseline(baseline, ws, rs)) {
+      std::cerr << "cannot write '" << baseline << "'\n";
+      return 1;
+    }
+    return 0;
+  }
+  if (json.empty())
+    std::cout << "no baseline in " << baseline
+              << ", write one on this host with --update\n";
+  if (failed)
+    std::cout << "performance regression against " << baseline
+              << "\n";
+  return failed;
+}
+
+}
+
+int main(int argc, const char *argv[]) {
+  return bench::run(argc, argv);
+}
@@ -1,17 +1,46 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <set>
+#include <random>
 #include <sstream>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 // #define DEBUG
 
+#if defined(__unix__)
+#  define HAVE_MMAP 1
+#  include <cerrno>
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <unistd.h>
+#else
+#  define HAVE_MMAP 0
+#endif
+
+#if defined(__x86_64__) && HAVE_MMAP
+#  define HAVE_JIT 1
+#else
+#  define HAVE_JIT 0
+#endif
+
 #ifdef DEBUG
 #  define pdbg(fmt, ...)                              \
     std::cerr << formatv("%s: [%s:%s]" fmt, __LINE__, \
@@ -22,959 +51,5267 @@
 
 namespace opt {
 bool verbose = false;
+bool batch = false;
+bool emit_cpp = false;
+bool jit = false;
+bool skip = true;
+bool macro = false;
+bool detect = false;
+unsigned macro_block = 0; // 0 for the default
+unsigned jobs = 1;
+enum TapeKind { TAPE_FLAT, TAPE_RLE, TAPE_PAGED, TAPE_PACKED };
+TapeKind tape = TAPE_FLAT;
+// resident MiB per paged tape, 0 for no cap
+size_t tape_mem = 0;
+// budgets of one run, 0 for none
+uint64_t max_steps = 0;
+uint64_t max_tape_cells = 0;
+double timeout = 0;   // seconds
+double heartbeat = 0; // seconds between progress reports
+// snapshot file, nullptr for none
+const char *checkpoint = nullptr;
+const char *restore = nullptr;
+double checkpoint_every = 0; // seconds, 0 for no interval
+bool debug = false;
+uint64_t debug_every = 1 << 20; // steps between copies
+const char *trace = nullptr;
+uint64_t trace_every = 1 << 20; // steps between keyframes
+// json report, nullptr for no profiling
+const char *profile = nullptr;
+// tape access statistics, nullptr for none
+const char *heatmap = nullptr;
 }
 
+/* set by SIGUSR1, a progress report is printed at the next
+ * budget check */
+volatile std::sig_atomic_t heartbeat_pending = 0;
+/* set by SIGTERM with --checkpoint, the run is saved and
+ * stopped at the next budget check */
+volatile std::sig_atomic_t terminate_pending = 0;
+
 class Tape {
-  std::vector<char> p_tape; // 0, 1, 2, ...
-  std::vector<char> n_tape; // -1, -2, ...
+  /* cell i lives at buf[origin + i], cells outside the
+   * buffer are blank */
+  std::vector<char> buf;
+  int64_t origin = 0;
+  int64_t lo = 0, hi = 0;   // written cells, [lo, hi)
+  /* the non-blank cells are in [nlo, nhi), exactly unless
+   * dirty, shrink() narrows it when it is asked for */
+  mutable int64_t nlo = 0, nhi = 0;
+  mutable bool dirty = false;
   char blank = '_';
   int64_t index = 0;
 
-  char tape_at(int64_t i) const {
-    /* emplace back blank */
-    if (i >= 0) {
-      if (i >= (int64_t)p_tape.size()) return blank;
-      return p_tape.at(i);
-    } else {
-      if (-i - 1 >= (int64_t)n_tape.size()) return blank;
-      return n_tape.at(-i - 1);
+  /* make cell i addressable, growing the buffer
+   * geometrically towards i */
+  void reserve(int64_t i) {
+    int64_t left = origin;
+    int64_t right = buf.size() - origin;
+    int64_t nleft = left, nright = right;
+    if (i < -left)
+      nleft = std::max<int64_t>({-i, 2 * left, 64});
+    if (i >= right)
+      nright = std::max<int64_t>({i + 1, 2 * right, 64});
+
+    std::vector<char> nbuf(nleft + nright, blank);
+    std::copy(buf.begin(), buf.end(),
+        nbuf.begin() + (nleft - left));
+    buf.swap(nbuf);
+    origin = nleft;
+  }
+
+  /* first cell other than ch in [l, r), r if none, scanned
+   * a word at a time */
+  int64_t skipSame(int64_t l, int64_t r, char ch) const {
+    const uint64_t same =
+        0x0101010101010101ull * (unsigned char)ch;
+    for (uint64_t w; l + 8 <= r; l += 8) {
+      memcpy(&w, &buf[l + origin], 8);
+      if (w != same) break;
     }
+    while (l < r && buf[l + origin] == ch) l++;
+    return l;
   }
 
-  char &tape_at(int64_t i) {
-    /* emplace back blank */
-    if (i >= 0) {
-      while ((int64_t)p_tape.size() < i + 1)
-        p_tape.push_back(blank);
-      return p_tape.at(i);
-    } else {
-      while ((int64_t)n_tape.size() < -i)
-        n_tape.push_back(blank);
-      return n_tape.at(-i - 1);
+  /* end of the last cell other than ch in [l, r), l if
+   * none */
+  int64_t skipSameBack(int64_t l, int64_t r, char ch) const {
+    const uint64_t same =
+        0x0101010101010101ull * (unsigned char)ch;
+    for (uint64_t w; r - 8 >= l; r -= 8) {
+      memcpy(&w, &buf[r - 8 + origin], 8);
+      if (w != same) break;
+    }
+    while (l < r && buf[r - 1 + origin] == ch) r--;
+    return r;
+  }
+
+  int64_t skipBlank(int64_t l, int64_t r) const {
+    return skipSame(l, r, blank);
+  }
+  int64_t skipBlankBack(int64_t l, int64_t r) const {
+    return skipSameBack(l, r, blank);
+  }
+
+  /* narrow [nlo, nhi) down to the non-blank cells */
+  void shrink() const {
+    if (!dirty) return;
+    nlo = skipBlank(nlo, nhi);
+    nhi = skipBlankBack(nlo, nhi);
+    dirty = false;
+  }
+
+  char tape_at(int64_t i) const {
+    uint64_t off = i + origin;
+    return off < buf.size() ? buf[off] : blank;
+  }
+
+  void write(int64_t i, char ch) {
+    if ((uint64_t)(i + origin) >= buf.size()) reserve(i);
+    if (i < lo)
+      lo = i;
+    else if (i >= hi)
+      hi = i + 1;
+    buf[i + origin] = ch;
+
+    /* a blank over an edge of the non-blank extent only marks
+     * it dirty, so that writes stay O(1) */
+    if (ch != blank) {
+      if (nlo >= nhi) {
+        nlo = i;
+        nhi = i + 1;
+      } else if (i < nlo) {
+        nlo = i;
+      } else if (i >= nhi) {
+        nhi = i + 1;
+      }
+    } else if (i == nlo || i == nhi - 1) {
+      dirty = true;
     }
   }
 
 public:
   Tape(char blank) : blank(blank) {}
 
-  int64_t begin() const {
-    return n_tape.size() ? (-n_tape.size()) : 0;
-  }
-  int64_t end() const { return p_tape.size(); }
+  int64_t begin() const { return lo; }
+  int64_t end() const { return hi; }
+  /* bounds of the non-blank cells, cbegin() >= cend() if the
+   * tape is blank */
   int64_t cbegin() const {
-    int64_t l = begin();
-    int64_t r = end();
-    for (; l < r; l++)
-      if (tape_at(l) != blank) break;
-    return l;
+    shrink();
+    return nlo < nhi ? nlo : hi;
   }
   int64_t cend() const {
-    int64_t l = begin();
-    int64_t r = end();
-    for (; l < r; r--)
-      if (tape_at(r - 1) != blank) break;
-    return r;
+    shrink();
+    return nlo < nhi ? nhi : lo;
   }
 
-  size_t size() const { return p_tape.size(); }
+  size_t size() const { return hi > 0 ? hi : 0; }
   char get(int64_t i) const { return tape_at(i); }
-  char get() { return tape_at(index); }
+  char get() const { return tape_at(index); }
   int64_t get_index() const { return index; }
   void set(const std::string &s) {
-    p_tape.clear();
-    for (char ch : s) p_tape.push_back(ch);
+    std::fill(buf.begin() + origin, buf.end(), blank);
+    if (lo >= 0) lo = 0;
+    hi = 0;
+    nhi = std::min<int64_t>(nhi, 0);
+    dirty = true;
+    for (unsigned i = 0; i < s.size(); i++) write(i, s[i]);
   }
 
-  void setAndMove(char ch, char dir) {
-    tape_at(index) = ch;
-    if (dir == 'l')
-      index--;
-    else if (dir == 'r')
-      index++;
+  /* blank the tape and rewind the head, the buffer is kept
+   * for the next run */
+  void clear() {
+    std::fill(buf.begin(), buf.end(), blank);
+    lo = hi = nlo = nhi = 0;
+    dirty = false;
+    index = 0;
   }
 
-  std::string get_contents() const {
-    std::string ret;
-    for (int64_t i = cbegin(); i < cend(); i++)
-      ret.push_back(tape_at(i));
-    return ret;
+  /* a cleared tape takes cells [at, at + n) and puts its head
+   * at head, for restoring snapshots */
+  void restore(int64_t at, const char *cells, int64_t n,
+      int64_t head) {
+    if (n) {
+      ensure(at);
+      ensure(at + n - 1);
+      memcpy(&buf[at + origin], cells, n);
+      touched(at, at + n);
+    }
+    index = head;
   }
-};
 
-bool operator<(const std::vector<char> &l,
-    const std::vector<char> &r) {
-  for (unsigned i = 0; i < l.size(); i++) {
-    if (i >= r.size()) return false;
-    if (l[i] != r[i]) return l[i] < r[i];
+  void setAndMove(char ch, char dir) {
+    setAndShift(ch, dir == 'l' ? -1 : (dir == 'r' ? 1 : 0));
   }
-  return l.size() < r.size();
-}
-
-class TuringMachine {
-  std::vector<Tape> tapes;
-  std::vector<std::string> stateStrings;
 
-  unsigned state = 0u;
-  char blank = '_';
-  std::set<unsigned> finalStates;
-  unsigned nr_steps = 0u;
+  void setAndShift(char ch, int shift) {
+    write(index, ch);
+    index += shift;
+  }
 
-  struct TransitionInfo {
-    //                  nxtSym, action
-    std::vector<std::pair<char, char>> nxtStep;
-    unsigned nxtState;
-  };
+  /* bytes held for cells */
+  size_t memory() const { return buf.capacity(); }
 
-  // state -> symbol vec -> transition info
-  std::vector<std::map<std::vector<char>, TransitionInfo>>
-      delta;
+  std::string get_contents() const {
+    shrink();
+    if (nlo >= nhi) return "";
+    return std::string(&buf[nlo + origin], nhi - nlo);
+  }
 
-  friend class TMParser;
+  /* number of cells equal to ch from the head on in the
+   * direction of shift, counting at most limit cells and only
+   * those inside the buffer */
+  int64_t runLength(char ch, int shift, int64_t limit) const {
+    int64_t l = first(), r = last();
+    if (index < l || index >= r) return 0;
+    if (shift > 0) {
+      r = index + std::min(limit, r - index);
+      return skipSame(index, r, ch) - index;
+    }
+    l = index + 1 - std::min(limit, index + 1 - l);
+    return index + 1 - skipSameBack(l, index + 1, ch);
+  }
 
-public:
-  TuringMachine(unsigned nTapes, char blank) {
-    this->blank = blank;
-    for (unsigned i = 0; i < nTapes; i++)
-      tapes.emplace_back(blank);
+  /* write ch to k cells from the head on while moving in the
+   * direction of shift, the cells must be in the buffer */
+  void fill(char ch, int shift, int64_t k) {
+    int64_t l = shift > 0 ? index : index - k + 1;
+    memset(&buf[l + origin], ch, k);
+    touched(l, l + k);
+    index += shift * k;
   }
 
-  void set_input(const std::string &s) {
-    if (tapes.size()) tapes.at(0).set(s);
+  /* the head stays on its cell for k steps of a skipped run */
+  void stay(int64_t) {}
+
+  /* raw access for engines that write cells themselves, cells
+   * [first(), last()) are addressable through data() */
+  char *data() { return buf.data() + origin; }
+  int64_t first() const { return -origin; }
+  int64_t last() const { return buf.size() - origin; }
+  void ensure(int64_t i) {
+    if ((uint64_t)(i + origin) >= buf.size()) reserve(i);
   }
+  void seek(int64_t i) { index = i; }
 
-  std::vector<char> getCurSymbols() {
-    std::vector<char> ret;
-    for (auto &tape : tapes) ret.push_back(tape.get());
-    return ret;
+  /* cells in [l, r) may have been written through data(),
+   * bring the extents up to date */
+  void touched(int64_t l, int64_t r) {
+    if (l >= r) return;
+    lo = std::min(lo, l);
+    hi = std::max(hi, r);
+
+    bool any = nlo < nhi;
+    nlo = any ? std::min(nlo, l) : l;
+    nhi = any ? std::max(nhi, r) : r;
+    dirty = true;
   }
+};
 
-  bool runOneStep() {
-    if (state >= delta.size()) {
-      // cannot proceed since no guidelines about current
-      // state
-      return true;
-    }
+/* run-length encoded tape, a zipper of two stacks of
+ * (symbol, length) runs around the cell under the head. The
+ * nearest run is the last element of each stack and adjacent
+ * runs of a stack always differ, so moves, writes and reading
+ * the extent are amortized O(1), and memory is proportional
+ * to the number of runs rather than to the tape length */
+class RleTape {
+  struct Run {
+    char sym;
+    int64_t len;
+  };
 
-    auto &m = delta[state];
-    auto symbols = getCurSymbols();
+  std::vector<Run> left;  // cells left of the head
+  std::vector<Run> right; // cells right of the head
+  int64_t leftLen = 0, rightLen = 0;
+  char cur;
+  char blank = '_';
+  int64_t index = 0;
 
-    auto it = m.find(symbols);
-    if (it == m.end()) {
-      // cannot proceed since no guidelines about current
-      // tape symbols
-      return true;
-    }
+  /* last run located by get(i), so that walking the tape cell
+   * by cell does not rescan the stacks */
+  mutable struct {
+    bool valid = false;
+    int side;
+    size_t k;
+    int64_t pos;
+  } hint;
 
-    auto &info = it->second;
-    auto &step = info.nxtStep;
+  /* no blank run is ever kept at the bottom of a stack, cells
+   * beyond it are blank anyway */
+  void push(std::vector<Run> &s, int64_t &total, char sym,
+      int64_t len) {
+    if (s.empty() && sym == blank) return;
+    if (s.size() && s.back().sym == sym)
+      s.back().len += len;
+    else
+      s.push_back(Run{sym, len});
+    total += len;
+  }
 
-    /* set new state */
-#ifdef DEBUG
-    assert(step.size() == tapes.size());
-#endif
-    for (unsigned i = 0; i < step.size(); i++)
-      if (i < tapes.size())
-        tapes[i].setAndMove(step[i].first, step[i].second);
-    state = info.nxtState;
-    return false;
+  char pop(std::vector<Run> &s, int64_t &total) {
+    if (s.empty()) return blank;
+    char sym = s.back().sym;
+    if (--s.back().len == 0) s.pop_back();
+    total--;
+    return sym;
   }
 
-  std::string run() {
-    if (opt::verbose) printOneStep();
-    while (true) {
-      if (runOneStep()) break;
-      nr_steps++;
-      if (opt::verbose) printOneStep();
-      if (finalStates.find(state) != finalStates.end())
-        break;
+  void drop(std::vector<Run> &s, int64_t &total, int64_t k) {
+    while (k > 0 && s.size()) {
+      int64_t n = std::min(k, s.back().len);
+      s.back().len -= n;
+      total -= n;
+      k -= n;
+      if (s.back().len == 0) s.pop_back();
     }
+  }
 
-    if (tapes.empty()) return "";
-    return tapes.at(0).get_contents();
+  void moveTo(int64_t i) {
+    hint.valid = false;
+    for (; index < i; index++) {
+      push(left, leftLen, cur, 1);
+      cur = pop(right, rightLen);
+    }
+    for (; index > i; index--) {
+      push(right, rightLen, cur, 1);
+      cur = pop(left, leftLen);
+    }
   }
 
-  void printOneStep() {
-    /* Step   : 0
-     * Index0 : 0 1 2 3 4 5 6
-     * Tape0  : 1 0 0 1 0 0 1
-     * Head0  : ^
-     * Index1 : 0
-     * Tape1  : _
-     * Head1  : ^
-     * State  : 0
-     * ---------------------------------------------
-     **/
-    std::cout << "Step   : " << nr_steps << "\n";
+public:
+  RleTape(char blank) : cur(blank), blank(blank) {}
 
-    for (unsigned i = 0; i < tapes.size(); i++) {
-      int64_t cbegin = tapes[i].cbegin();
-      int64_t cend = tapes[i].cend();
-      int64_t index = tapes[i].get_index();
-      if (cbegin >= cend) {
-        cbegin = index;
-        cend = index + 1;
-      } else if (index >= cend) {
-        cend = index + 1;
-      } else if (index < cbegin) {
-        cbegin = index;
-      }
+  int64_t begin() const { return index - leftLen; }
+  int64_t end() const { return index + 1 + rightLen; }
 
-      std::cout << "Index" << i << " :";
-      for (int64_t j = cbegin; j < cend; j++)
-        if (j >= 0)
-          std::cout << " " << j;
-        else
-          std::cout << " " << -j;
-      std::cout << "\n";
+  /* bounds of the non-blank cells, cbegin() >= cend() if the
+   * tape is blank */
+  int64_t cbegin() const {
+    if (left.size()) return index - leftLen;
+    if (cur != blank) return index;
+    if (right.empty()) return index;
+    return index + 1 +
+           (right.back().sym == blank ? right.back().len : 0);
+  }
+  int64_t cend() const {
+    if (right.size()) return index + 1 + rightLen;
+    if (cur != blank) return index + 1;
+    if (left.empty()) return index;
+    return index -
+           (left.back().sym == blank ? left.back().len : 0);
+  }
 
-      std::cout << "Tape" << i << "  :";
-      for (int64_t j = cbegin; j < cend; j++) {
-        unsigned n = 1;
-        if (j != cbegin) {
-          if (j < 1)
-            n = std::to_string(j - 1).size() - 1;
-          else
-            n = std::to_string(j - 1).size();
-        }
-        for (unsigned i = 0; i < n; i++) std::cout << " ";
-        std::cout << tapes[i].get(j);
-      }
-      std::cout << "\n";
+  char get(int64_t i) const {
+    if (i == index) return cur;
+    int side = i < index ? -1 : 1;
+    const std::vector<Run> &s = side < 0 ? left : right;
+    size_t k = s.size();
+    int64_t d = (i - index) * side - 1; // cells in between
+    int64_t pos = 0; // cells between the run and the head
+    if (hint.valid && hint.side == side && hint.pos <= d)
+      k = hint.k, pos = hint.pos;
 
-      std::cout << "Head" << i << "  :";
-      for (int64_t j = cbegin; j < index; j++) {
-        unsigned n = (j >= 0)
-                         ? std::to_string(j).size()
-                         : (std::to_string(j).size() - 1);
-        for (unsigned k = 0; k < n + 1; k++)
-          std::cout << " ";
+    for (; k > 0; k--) {
+      if (d < pos + s[k - 1].len) {
+        hint = {true, side, k, pos};
+        return s[k - 1].sym;
       }
-      std::cout << " ^\n";
+      pos += s[k - 1].len;
     }
-
-    std::cout << "State  : " << stateStrings.at(state)
-              << "\n";
-    /* clang-format off */
-    std::cout << "---------------------------------------------\n";
-    /* clang-format on */
+    return blank;
   }
+  char get() const { return cur; }
+  int64_t get_index() const { return index; }
 
-  void dump() {
-    std::clog << "#Q = {";
-    for (const std::string &s : stateStrings)
-      std::clog << s << ", ";
-    std::clog << "}\n";
-
-    std::clog << "#q0 = " << stateStrings.at(state) << "\n";
-    std::clog << "#B = " << blank << "\n";
-
-    std::clog << "#F = {";
-    for (unsigned s : finalStates)
-      std::clog << stateStrings.at(s) << ", ";
-    std::clog << "}\n";
-
-    std::clog << "#N = " << tapes.size() << "\n";
-
-    for (unsigned i = 0; i < delta.size(); i++) {
-      auto &m = delta[i];
-      for (auto &kvpair : m) {
-        const std::vector<char> &symvec = kvpair.first;
-        TransitionInfo &info = kvpair.second;
+  void set(const std::string &s) {
+    int64_t old = index;
+    moveTo(0);
+    right.clear();
+    rightLen = 0;
+    for (size_t j = s.size(); j > 1; j--)
+      push(right, rightLen, s[j - 1], 1);
+    cur = s.size() ? s[0] : blank;
+    moveTo(old);
+  }
 
-        std::clog << stateStrings[i] << " ";
-        for (char ch : symvec) std::clog << ch;
-        std::clog << " ";
+  void clear() {
+    left.clear();
+    right.clear();
+    leftLen = rightLen = 0;
+    cur = blank;
+    index = 0;
+    hint.valid = false;
+  }
 
-        for (std::pair<char, char> chs : info.nxtStep)
-          std::clog << chs.first;
-        std::clog << " ";
+  void restore(int64_t at, const char *cells, int64_t n,
+      int64_t head) {
+    index = at; // no runs yet, nothing to move
+    for (int64_t j = n; j > 1; j--)
+      push(right, rightLen, cells[j - 1], 1);
+    cur = n ? cells[0] : blank;
+    moveTo(head);
+  }
 
-        for (std::pair<char, char> chs : info.nxtStep)
-          std::clog << chs.second;
-        std::clog << " ";
+  void setAndMove(char ch, char dir) {
+    setAndShift(ch, dir == 'l' ? -1 : (dir == 'r' ? 1 : 0));
+  }
 
-        std::clog << stateStrings[info.nxtState] << "\n";
-      }
+  void setAndShift(char ch, int shift) {
+    if (shift > 0) {
+      push(left, leftLen, ch, 1);
+      cur = pop(right, rightLen);
+    } else if (shift < 0) {
+      push(right, rightLen, ch, 1);
+      cur = pop(left, leftLen);
+    } else {
+      cur = ch;
     }
+    index += shift;
+    hint.valid = false;
   }
-};
 
-template <class... Args>
-std::string formatv(const char *fmt, Args &&... args) {
-  std::vector<std::string> args_strs = {
-      static_cast<std::ostringstream &>(
-          std::ostringstream{}
-          << std::forward<Args>((Args)args))
-          .str()...};
+  int64_t runLength(char ch, int shift, int64_t limit) const {
+    if (cur != ch) return 0;
+    const std::vector<Run> &s = shift > 0 ? right : left;
+    if (s.empty()) return ch == blank ? limit : 1;
+    int64_t n = 1;
+    if (s.back().sym == ch) {
+      n += s.back().len;
+      /* the bottom run is never blank, but a blank run can
+       * reach the end of the stack only through it */
+      if (s.size() == 1 && ch == blank) return limit;
+    }
+    return std::min(n, limit);
+  }
 
-  std::string ret;
-  unsigned counter = 0;
-  for (const char *p = fmt; *p; p++) {
-    if (*p == '%') {
-      p++;
-      if (*p == 's')
-        ret += args_strs.at(counter++);
-      else if (*p != 0)
-        ret += *p;
-      else
-        break;
+  void fill(char ch, int shift, int64_t k) {
+    if (shift > 0) {
+      push(left, leftLen, ch, k);
+      drop(right, rightLen, k - 1);
+      cur = pop(right, rightLen);
     } else {
-      ret += *p;
+      push(right, rightLen, ch, k);
+      drop(left, leftLen, k - 1);
+      cur = pop(left, leftLen);
     }
+    index += shift * k;
+    hint.valid = false;
   }
-  return ret;
-}
 
-#if 0
-template <class T>
-class error_or : public std::optional<T> {
-  std::ostringstream oss;
-
-public:
-  using std::optional<T>::optional<T>;
-  using std::optional<T>::operator=;
-  using std::optional<T>::operator bool;
+  /* the head stays on its cell for k steps of a skipped run */
+  void stay(int64_t) {}
 
-  template <class U>
-  friend error_or &operator<<(error_or &os, U &&msg) {
-    oss << std::forward<U>(msg);
-    return *this;
+  /* bytes held for runs */
+  size_t memory() const {
+    return (left.capacity() + right.capacity()) * sizeof(Run);
   }
 
-  const std::string &get_error() const { return oss.str(); }
-  std::string &&get_error() { return oss.str(); }
+  std::string get_contents() const {
+    std::string ret;
+    for (const Run &r : left) ret.append(r.len, r.sym);
+    ret.push_back(cur);
+    for (size_t k = right.size(); k > 0; k--)
+      ret.append(right[k - 1].len, right[k - 1].sym);
 
-  bool has_error() {
-    return !bool(static_cast<std::optional<T> &>(*this));
+    size_t l = ret.find_first_not_of(blank);
+    if (l == std::string::npos) return "";
+    size_t r = ret.find_last_not_of(blank);
+    return ret.substr(l, r - l + 1);
   }
 };
-#endif
 
-class wrapped_istream {
-  unsigned lineno = 0;
-  unsigned column = 0;
-  std::vector<std::string> lines;
-  std::istream &is;
-
-  void advance_cursor(char ch) {
-    if (ch == '\n' || ch == ';') {
-      lineno++;
-      column = 0;
-      lines.emplace_back();
-      if (ch == ';')
-        while (is.good() && is.get() != '\n')
-          ;
-    } else {
-      lines.back().push_back(ch);
-      column++;
+#if HAVE_MMAP
+/* fixed-size slots in an unlinked temporary file mapped into
+ * memory. Spilled pages are file-backed, so the kernel can
+ * write them back and drop them instead of running out of
+ * memory */
+class SpillFile {
+  int fd = -1;
+  char *base = nullptr;
+  size_t slotSize;
+  size_t nslots = 0, used = 0;
+  std::vector<size_t> freeSlots;
+
+  bool grow() {
+    if (fd < 0) {
+      const char *dir = getenv("TMPDIR");
+      std::string path = std::string(dir ? dir : "/tmp") +
+                         "/turing-spill-XXXXXX";
+      fd = mkstemp(&path[0]);
+      if (fd < 0) return false;
+      unlink(path.c_str());
     }
+
+    size_t n = std::max<size_t>(64, 2 * nslots);
+    if (ftruncate(fd, n * slotSize)) return false;
+    void *mem = mmap(nullptr, n * slotSize,
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) return false;
+    if (base) munmap(base, nslots * slotSize);
+    base = (char *)mem;
+    nslots = n;
+    return true;
   }
 
 public:
-  wrapped_istream(std::istream &is) : is(is) {
-    lines.emplace_back();
+  SpillFile(size_t slotSize) : slotSize(slotSize) {}
+  SpillFile(const SpillFile &) = delete;
+  ~SpillFile() {
+    if (base) munmap(base, nslots * slotSize);
+    if (fd >= 0) close(fd);
   }
 
-  bool endl() const {
-    char ch = is.peek();
-    if (ch == '\n' || ch == ';') return true;
-    return !is.good();
+  /* slot holding a copy of data, -1 if the file cannot
+   * grow */
+  int64_t store(const char *data) {
+    size_t slot;
+    if (freeSlots.size()) {
+      slot = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      if (used == nslots && !grow()) return -1;
+      slot = used++;
+    }
+    memcpy(base + slot * slotSize, data, slotSize);
+    return slot;
   }
 
-  bool good() { return is.good(); }
+  const char *at(int64_t slot) const {
+    return base + slot * slotSize;
+  }
+  void release(int64_t slot) { freeSlots.push_back(slot); }
+  void clear() {
+    used = 0;
+    freeSlots.clear();
+  }
+};
+#endif
 
-  char get() {
-    char ch = is.get();
-    advance_cursor(ch);
-    return ch;
+/* tape split into fixed-size pages that are allocated on the
+ * first non-blank write, pages never written read as blank
+ * for free. With a resident cap (--tape-mem) the coldest
+ * pages, picked by a clock sweep, spill to a SpillFile */
+class PagedTape {
+  static constexpr int page_bits = 16;
+  static constexpr int64_t page_size = int64_t(1) << page_bits;
+  static constexpr int64_t page_mask = page_size - 1;
+
+  struct Page {
+    std::unique_ptr<char[]> data; // resident copy
+    int64_t slot = -1;            // or its slot when spilled
+    bool ref = false;             // recently used, for clock
+  };
+
+  std::unordered_map<int64_t, Page> pages;
+  std::vector<int64_t> ring; // resident pages
+  size_t hand = 0;
+  size_t maxResident; // 0 for no cap
+  std::vector<std::unique_ptr<char[]>> spare;
+#if HAVE_MMAP
+  std::unique_ptr<SpillFile> spill;
+#endif
+
+  int64_t lo = 0, hi = 0;   // written cells, [lo, hi)
+  /* the non-blank cells are in [nlo, nhi), exactly unless
+   * dirty, shrink() narrows it when it is asked for */
+  mutable int64_t nlo = 0, nhi = 0;
+  mutable bool dirty = false;
+  char blank = '_';
+  int64_t index = 0;
+
+  /* page of the head and its resident data, nullptr if the
+   * page does not exist. The head page is never spilled */
+  int64_t headPage = 0;
+  char *head = nullptr;
+
+  static int64_t pageOf(int64_t i) { return i >> page_bits; }
+
+  /* data of page p wherever it lives, nullptr if absent */
+  const char *peek(int64_t p) const {
+    if (p == headPage) return head;
+    auto it = pages.find(p);
+    if (it == pages.end()) return nullptr;
+    if (it->second.data) return it->second.data.get();
+#if HAVE_MMAP
+    return spill->at(it->second.slot);
+#else
+    return nullptr;
+#endif
   }
 
-  char peek() { return is.peek(); }
+  /* spill one cold page if the cap is reached */
+  void evict() {
+#if HAVE_MMAP
+    if (!maxResident || ring.size() < maxResident) return;
+    if (!spill) spill.reset(new SpillFile(page_size));
+    for (size_t n = 0; n < 2 * ring.size(); n++, hand++) {
+      if (hand >= ring.size()) hand = 0;
+      Page &pg = pages[ring[hand]];
+      if (ring[hand] == headPage || pg.ref) {
+        pg.ref = false;
+        continue;
+      }
 
-  void ignore() { advance_cursor(is.get()); }
+      int64_t slot = spill->store(pg.data.get());
+      if (slot < 0) return; // stay over the cap
+      pg.slot = slot;
+      spare.push_back(std::move(pg.data));
+      ring[hand] = ring.back();
+      ring.pop_back();
+      return;
+    }
+#endif
+  }
 
-  void getline(std::string &s) {
-    std::getline(is, s);
-    advance_cursor('\n');
+  /* page p made resident, created blank if absent */
+  char *load(int64_t p) {
+    Page &pg = pages[p];
+    if (!pg.data) {
+      evict();
+      if (spare.size()) {
+        pg.data = std::move(spare.back());
+        spare.pop_back();
+      } else {
+        pg.data.reset(new char[page_size]);
+      }
+#if HAVE_MMAP
+      if (pg.slot >= 0) {
+        memcpy(pg.data.get(), spill->at(pg.slot), page_size);
+        spill->release(pg.slot);
+        pg.slot = -1;
+      } else
+#endif
+        memset(pg.data.get(), blank, page_size);
+      ring.push_back(p);
+    }
+    pg.ref = true;
+    return pg.data.get();
   }
 
-  unsigned get_lineno() const { return lineno; }
-  unsigned get_column() const { return column; }
-  const std::string &get_line(unsigned i) const {
-    return lines.at(i);
+  void seekHead() {
+    headPage = pageOf(index);
+    head = nullptr; // peek() must not see the old page
+    head = pages.count(headPage) ? load(headPage) : nullptr;
   }
-};
 
-class TMParser {
-  bool found_error = false;
-  std::map<std::string, unsigned> stateIdMap;
-  struct StringToken : public std::string {
-    unsigned lineno = 0;
-    unsigned column = 0;
-    using std::string::string;
-    using std::string::operator=;
-  };
+  /* first non-blank cell in [l, r), r if none */
+  int64_t skipBlank(int64_t l, int64_t r) const {
+    while (l < r) {
+      int64_t e = std::min(r, (pageOf(l) + 1) * page_size);
+      if (const char *d = peek(pageOf(l)))
+        for (; l < e; l++)
+          if (d[l & page_mask] != blank) return l;
+      l = e;
+    }
+    return r;
+  }
 
-  // #Q = {0,cp,cmp,mh,accept}
-  std::vector<StringToken> states;
-  // #S = {0,1}
-  std::vector<StringToken> inputSymbolSet; // #S
-  // #G = {0,1,_,t,r,u,e,f,a,l,s}
-  std::vector<StringToken> tapeSymbolSet; // #G
-  // #q0 = 0
-  StringToken initState;
-  // #B = _
-  StringToken blankSymbol; // #B
-  // #F = {halt_accept}
-  std::vector<StringToken> finalStates; // #F
-  // #N = 2
-  unsigned nTapes = -1u; // #N
-  // cmp 01 __ rl reject
-  // 0 __ __ ** accept
+  /* end of the last non-blank cell in [l, r), l if none */
+  int64_t skipBlankBack(int64_t l, int64_t r) const {
+    while (l < r) {
+      int64_t b = std::max(l, pageOf(r - 1) * page_size);
+      if (const char *d = peek(pageOf(r - 1)))
+        for (; r > b; r--)
+          if (d[(r - 1) & page_mask] != blank) return r;
+      r = b;
+    }
+    return l;
+  }
 
-  struct DeltaEntry {
-    StringToken curState;
-    StringToken curSymbols;
-    StringToken nxtSymbols;
-    StringToken actions;
-    StringToken nxtState;
-  };
-  std::vector<DeltaEntry> delta;
+  /* narrow [nlo, nhi) down to the non-blank cells */
+  void shrink() const {
+    if (!dirty) return;
+    nlo = skipBlank(nlo, nhi);
+    nhi = skipBlankBack(nlo, nhi);
+    dirty = false;
+  }
 
-  void report_error_here(
-      const std::string &msg, wrapped_istream &wis) {
-    StringToken s(" ");
-    s.lineno = wis.get_lineno();
-    s.column = wis.get_column();
-    report_error(s, msg, wis);
+  /* cells [l, r) were all set to ch */
+  void touched(int64_t l, int64_t r, char ch) {
+    lo = std::min(lo, l);
+    hi = std::max(hi, r);
+    if (ch != blank) {
+      bool any = nlo < nhi;
+      nlo = any ? std::min(nlo, l) : l;
+      nhi = any ? std::max(nhi, r) : r;
+    } else if (nlo < nhi && l < nhi && r > nlo &&
+               (l <= nlo || r >= nhi)) {
+      dirty = true; // an edge went blank
+    }
   }
 
-  void report_error(const StringToken &tok,
-      const std::string &msg, wrapped_istream &wis) {
-    found_error = true;
-    if (!opt::verbose) {
-      std::cerr << "syntax error\n";
-      exit(1);
+  /* set cells [l, r) of one page to ch, blank writes to an
+   * absent page cost nothing */
+  void store(int64_t l, int64_t r, char ch) {
+    int64_t p = pageOf(l);
+    char *d = p == headPage ? head : nullptr;
+    if (!d) {
+      if (ch == blank && !pages.count(p)) return;
+      d = load(p);
+      if (p == headPage) head = d;
     }
+    memset(d + (l & page_mask), ch, r - l);
+  }
 
-    std::cerr << "error at line " << (tok.lineno + 1)
-              << " column " << (tok.column + 1) << ": "
-              << msg << "\n";
-    std::cerr << wis.get_line(tok.lineno);
-    if (tok.lineno == wis.get_lineno()) {
-      char ch = wis.peek();
-      if (ch != '\n') std::cerr << ch;
+  void dropPages(int64_t from) {
+    for (auto it = pages.begin(); it != pages.end();) {
+      if (it->first < from) {
+        ++it;
+        continue;
+      }
+      if (it->second.data)
+        spare.push_back(std::move(it->second.data));
+#if HAVE_MMAP
+      else
+        spill->release(it->second.slot);
+#endif
+      it = pages.erase(it);
     }
-    std::cerr << '\n';
-    for (unsigned i = 0; i < tok.column; i++)
-      std::cerr << " ";
-    for (unsigned i = 0;
-         i < std::max<unsigned>(tok.size(), 1u); i++)
-      std::cerr << "^";
-    std::cerr << '\n';
+    ring.erase(std::remove_if(ring.begin(), ring.end(),
+                   [from](int64_t p) { return p >= from; }),
+        ring.end());
+    hand = 0;
   }
 
-private:
-  static void stringStrip(std::string &s) {
-    s.erase(0, s.find_first_not_of(" \t\v\f"));
-    s.erase(s.find_last_not_of(" \t\v\f"), s.npos);
+public:
+  PagedTape(char blank)
+      : maxResident(0), blank(blank) {
+    if (opt::tape_mem)
+      maxResident = std::max<size_t>(
+          2, (opt::tape_mem << 20) >> page_bits);
   }
 
-  bool erase_blank(wrapped_istream &wis) {
-    while (std::isblank(wis.peek()) && wis.good())
-      wis.ignore();
-    return wis.good();
+  int64_t begin() const { return lo; }
+  int64_t end() const { return hi; }
+  /* bounds of the non-blank cells, cbegin() >= cend() if the
+   * tape is blank */
+  int64_t cbegin() const {
+    shrink();
+    return nlo < nhi ? nlo : hi;
+  }
+  int64_t cend() const {
+    shrink();
+    return nlo < nhi ? nhi : lo;
   }
 
-  bool erase_blank_until(wrapped_istream &wis, char ch) {
-    erase_blank(wis);
-    if (wis.get() != ch) {
-      report_error_here(
-          formatv("expected `%s' here", ch), wis);
-      return false;
+  char get(int64_t i) const {
+    const char *d = peek(pageOf(i));
+    return d ? d[i & page_mask] : blank;
+  }
+  char get() const {
+    return head ? head[index & page_mask] : blank;
+  }
+  int64_t get_index() const { return index; }
+
+  void set(const std::string &s) {
+    dropPages(0);
+    if (lo >= 0) lo = 0;
+    hi = 0;
+    nhi = std::min<int64_t>(nhi, 0);
+    dirty = true;
+    seekHead();
+    for (unsigned i = 0; i < s.size(); i++) {
+      store(i, i + 1, s[i]);
+      touched(i, i + 1, s[i]);
     }
-    return wis.good();
   }
 
-  StringToken parseStringToken(wrapped_istream &wis,
-      std::function<bool(char)> tester) {
-    StringToken token;
-    token.lineno = wis.get_lineno();
-    token.column = wis.get_column();
-    while (!wis.endl()) {
-      char ch = wis.peek();
-      if (tester(ch)) {
-        wis.ignore();
-        token.push_back(ch);
-      } else
-        break;
+  /* blank the tape and rewind the head, a few page buffers
+   * are kept for the next run */
+  void clear() {
+    dropPages(INT64_MIN);
+    if (spare.size() > 16) spare.resize(16);
+#if HAVE_MMAP
+    if (spill) spill->clear();
+#endif
+    lo = hi = nlo = nhi = 0;
+    dirty = false;
+    index = 0;
+    seekHead();
+  }
+
+  void restore(int64_t at, const char *cells, int64_t n,
+      int64_t head) {
+    for (int64_t a = at; a < at + n;) {
+      int64_t e = std::min(at + n, (pageOf(a) + 1) * page_size);
+      memcpy(load(pageOf(a)) + (a & page_mask), cells + (a - at),
+          e - a);
+      a = e;
+    }
+    index = head;
+    seekHead(); // before peek() is used
+    if (n) {
+      lo = std::min(lo, at);
+      hi = std::max(hi, at + n);
+      nlo = skipBlank(at, at + n);
+      nhi = skipBlankBack(nlo, at + n);
+      dirty = false;
     }
-    return token;
   }
 
-  StringToken parseState(wrapped_istream &wis) {
-    StringToken state = parseStringToken(wis, [](char ch) {
-      return std::isalnum(ch) || ch == '_';
-    });
+  void setAndMove(char ch, char dir) {
+    setAndShift(ch, dir == 'l' ? -1 : (dir == 'r' ? 1 : 0));
+  }
 
-    if (state.size() == 0)
-      report_error_here("expected state here", wis);
-    return state;
+  void setAndShift(char ch, int shift) {
+    if (head)
+      head[index & page_mask] = ch;
+    else
+      store(index, index + 1, ch);
+    touched(index, index + 1, ch);
+    index += shift;
+    if (pageOf(index) != headPage) seekHead();
   }
 
-  StringToken parseActions(wrapped_istream &wis) {
-    StringToken symbol = parseStringToken(wis, [](char ch) {
-      return std::isprint(ch) && ch != ' ' && ch != ',' &&
-             ch != ';' && ch != '{' && ch != '}';
-    });
+  /* number of cells equal to ch from the head on in the
+   * direction of shift, counting at most limit cells */
+  int64_t runLength(char ch, int shift, int64_t limit) const {
+    int64_t n = 0, i = index;
+    while (n < limit) {
+      int64_t p = pageOf(i);
+      int64_t k = shift > 0 ? (p + 1) * page_size - i
+                            : i - p * page_size + 1;
+      k = std::min(k, limit - n);
+      const char *d = peek(p);
+      if (!d) {
+        if (ch != blank) break;
+        n += k;
+        i += shift * k;
+        continue;
+      }
+      for (; k > 0 && d[i & page_mask] == ch; k--, i += shift)
+        n++;
+      if (k) break;
+    }
+    return n;
+  }
 
-    if (symbol.size() == 0)
-      report_error_here("expected input symbol here", wis);
-    return symbol;
+  /* write ch to k cells from the head on while moving in the
+   * direction of shift */
+  void fill(char ch, int shift, int64_t k) {
+    int64_t l = shift > 0 ? index : index - k + 1;
+    int64_t r = l + k;
+    for (int64_t a = l; a < r;) {
+      int64_t e = std::min(r, (pageOf(a) + 1) * page_size);
+      store(a, e, ch);
+      a = e;
+    }
+    touched(l, r, ch);
+    index += shift * k;
+    if (pageOf(index) != headPage) seekHead();
   }
 
-  StringToken parseInputSymbol(wrapped_istream &wis) {
-    StringToken symbol = parseStringToken(wis, [](char ch) {
-      return std::isprint(ch) && ch != ' ' && ch != ',' &&
-             ch != ';' && ch != '{' && ch != '}' &&
-             ch != '*' && ch != '_';
-    });
+  /* the head stays on its cell for k steps of a skipped run */
+  void stay(int64_t) {}
 
-    if (symbol.size() == 0)
-      report_error_here("expected input symbol here", wis);
-    return symbol;
+  /* bytes of resident and spare pages */
+  size_t memory() const {
+    return (ring.size() + spare.size()) * page_size;
   }
 
-  StringToken parseTapeSymbol(wrapped_istream &wis) {
-    StringToken symbol = parseStringToken(wis, [](char ch) {
-      return std::isprint(ch) && ch != ' ' && ch != ',' &&
-             ch != ';' && ch != '{' && ch != '}' &&
-             ch != '*';
-    });
+  std::string get_contents() const {
+    shrink();
+    std::string ret;
+    for (int64_t l = nlo; l < nhi;) {
+      int64_t e = std::min(nhi, (pageOf(l) + 1) * page_size);
+      if (const char *d = peek(pageOf(l)))
+        ret.append(d + (l & page_mask), e - l);
+      else
+        ret.append(e - l, blank);
+      l = e;
+    }
+    return ret;
+  }
+};
 
-    if (symbol.size() == 0)
-      report_error_here("expected tape symbol here", wis);
-    return symbol;
+/* delta compiled into a flat table: tape symbols are
+ * remapped to dense ids and a symbol tuple is packed into
+ * one index,
+ *   index = id(sym0) + id(sym1) * radix + ...
+ * so that a step costs one table load instead of a map
+ * lookup
+ */
+class TransitionTable {
+public:
+  struct TransitionInfo {
+    //                  nxtSym, action
+    std::vector<std::pair<char, char>> nxtStep;
+    unsigned nxtState;
+    unsigned curState;
+    std::string curSymbols;
+  };
+
+  /* write/move record of one tape, stored inline */
+  struct StepRecord {
+    char sym;
+    int8_t shift; // -1, 0, 1
+  };
+
+  enum : uint8_t { FINAL = 1, HALTING = 2 };
+  enum : uint8_t { SWEEP = 1 };
+  static constexpr uint32_t npos = -1u;
+  /* upper bound of entries in the dense table (16MB) */
+  static constexpr uint64_t max_dense = 1ull << 22;
+
+private:
+  unsigned nTapes = 0;
+  unsigned nStates = 0;
+  std::vector<char> symbols; // dense id -> symbol
+  uint64_t stride = 1;       // radix ^ nTapes
+  // nTapes x 256, symbol -> id * radix ^ i, or stride if
+  // the symbol is unknown
+  std::vector<uint64_t> symIndex;
+  // state * stride + index -> transition id
+  std::vector<uint32_t> dense;
+  std::unordered_map<uint64_t, uint32_t> sparse;
+  // symbol tuples do not fit in 64 bits
+  bool wide = false;
+  std::map<std::pair<unsigned, std::string>, uint32_t>
+      wideMap;
+
+  std::vector<uint8_t> flags;
+  std::vector<TransitionInfo> transitions;
+  // transition id * nTapes -> records of each tape
+  std::vector<StepRecord> steps;
+  // transition id -> next state
+  std::vector<unsigned> nxtStates;
+  // transition id -> SWEEP
+  std::vector<uint8_t> kinds;
+
+  /* N is the number of tapes if known at compile time */
+  template <unsigned N = 0>
+  uint64_t packSymbols(const char *syms) const {
+    uint64_t idx = 0;
+    for (unsigned i = 0; i < (N ? N : nTapes); i++)
+      idx += symIndex[i * 256 + (unsigned char)syms[i]];
+    return idx;
   }
 
-  std::vector<StringToken> parseStringArray(
-      wrapped_istream &wis,
-      StringToken (TMParser::*extractor)(
-          wrapped_istream &)) {
-    erase_blank(wis);
-    pdbg("[parseStringArray] after erase blank, '%s'\n",
-        wis.peek());
-    if (wis.get() != '{')
-      report_error_here(
-          "expected '{' here, parse it anyway", wis);
+public:
+  void init(unsigned nStates, unsigned nTapes,
+      const std::vector<char> &alphabet) {
+    this->nStates = nStates;
+    this->nTapes = nTapes;
+    symbols.clear();
+    std::vector<int> symId(256, -1);
+    for (char ch : alphabet) {
+      if (symId[(unsigned char)ch] >= 0) continue;
+      symId[(unsigned char)ch] = symbols.size();
+      symbols.push_back(ch);
+    }
 
-    std::vector<StringToken> retSet;
-    while (!wis.endl()) {
-      erase_blank(wis);
-      StringToken s = (this->*extractor)(wis);
-      pdbg(
-          "[parseStringArray] extract '%s'-'%s' "
-          "[%s:%s:%s]\n",
-          std::string(s), wis.peek(), s.lineno, s.column,
-          s.size());
-      if (s.size() > 0) retSet.push_back(s);
+    uint64_t radix = std::max<uint64_t>(symbols.size(), 1);
+    stride = 1;
+    for (unsigned i = 0; i < nTapes && !wide; i++) {
+      if (stride > (UINT64_MAX >> 2) / radix)
+        wide = true;
+      else
+        stride *= radix;
+    }
+    if (!wide && nStates > (UINT64_MAX >> 2) / stride)
+      wide = true;
 
-      erase_blank(wis);
-      if (wis.endl()) break;
+    symIndex.assign(nTapes * 256, stride);
+    uint64_t weight = 1;
+    for (unsigned i = 0; i < nTapes && !wide; i++) {
+      for (unsigned ch = 0; ch < 256; ch++)
+        if (symId[ch] >= 0)
+          symIndex[i * 256 + ch] = symId[ch] * weight;
+      weight *= radix;
+    }
 
-      char ch = wis.get();
-      if (ch == '}')
-        break;
-      else if (ch == ',')
-        continue;
-      else {
-        StringToken tok;
-        tok.lineno = wis.get_lineno();
-        tok.column = wis.get_column() - 1;
-        report_error(tok, "expected '}' or ',' here", wis);
+    dense.clear();
+    sparse.clear();
+    wideMap.clear();
+    if (!wide && nStates * stride <= max_dense)
+      dense.assign(nStates * stride, npos);
+
+    flags.assign(nStates, HALTING);
+    transitions.clear();
+    steps.clear();
+    nxtStates.clear();
+    kinds.clear();
+  }
+
+  void add(unsigned curState, const std::string &curSymbols,
+      TransitionInfo &&info) {
+    info.curState = curState;
+    info.curSymbols = curSymbols;
+
+    uint32_t *slot = nullptr;
+    if (wide) {
+      auto key = std::make_pair(curState, curSymbols);
+      slot = &wideMap.emplace(key, npos).first->second;
+    } else {
+      uint64_t key = curState * stride +
+                     packSymbols(curSymbols.data());
+      if (dense.size())
+        slot = &dense[key];
+      else
+        slot = &sparse.emplace(key, npos).first->second;
+    }
+
+    /* a later definition overrides the former one */
+    if (*slot == npos) {
+      *slot = transitions.size();
+      transitions.emplace_back();
+      steps.resize(steps.size() + nTapes);
+      nxtStates.emplace_back();
+    }
+
+    StepRecord *rec = &steps[*slot * nTapes];
+    for (unsigned i = 0; i < nTapes; i++) {
+      char dir = info.nxtStep.at(i).second;
+      rec[i].sym = info.nxtStep[i].first;
+      rec[i].shift = dir == 'l' ? -1 : (dir == 'r' ? 1 : 0);
+    }
+    nxtStates[*slot] = info.nxtState;
+    transitions[*slot] = std::move(info);
+    flags.at(curState) &= ~HALTING;
+  }
+
+  void setFinal(unsigned state) {
+    flags.at(state) |= FINAL;
+  }
+
+  /* analysis once every transition has been added. A sweep is
+   * a self-loop of a non-final state in which every tape
+   * either moves or rewrites the symbol it reads, so that it
+   * keeps firing for as long as the moving heads read the
+   * same symbols and can be run over a whole run at once */
+  void finalize() {
+    kinds.assign(transitions.size(), 0);
+    for (uint32_t tid = 0; tid < transitions.size(); tid++) {
+      const TransitionInfo &info = transitions[tid];
+      if (info.nxtState != info.curState) continue;
+      if (flags[info.curState] & FINAL) continue;
+
+      const StepRecord *rec = stepsOf(tid);
+      bool moves = false, sweep = true;
+      for (unsigned i = 0; i < nTapes; i++) {
+        if (rec[i].shift)
+          moves = true;
+        else if (rec[i].sym != info.curSymbols[i])
+          sweep = false;
       }
+      if (moves && sweep) kinds[tid] |= SWEEP;
     }
+  }
 
-    erase_blank(wis);
-    pdbg("[parseStringArray] final blank '%s'\n",
-        wis.peek());
-    return retSet;
+  template <unsigned N = 0>
+  uint32_t lookup(unsigned state, const char *syms) const {
+    if (state >= nStates) return npos;
+    if (__builtin_expect(wide, 0)) {
+      auto it = wideMap.find(
+          std::make_pair(state, std::string(syms, nTapes)));
+      return it == wideMap.end() ? npos : it->second;
+    }
+
+    uint64_t idx = packSymbols<N>(syms);
+    if (idx >= stride) return npos;
+    uint64_t key = state * stride + idx;
+    if (dense.size()) return dense[key];
+    auto it = sparse.find(key);
+    return it == sparse.end() ? npos : it->second;
   }
 
-  std::vector<StringToken> parseStateArray(
-      wrapped_istream &wis) {
-    return parseStringArray(wis, &TMParser::parseState);
+  /* dense id of a symbol on the first tape, npos if it is
+   * not in the alphabet */
+  uint32_t symbolId(char ch) const {
+    uint64_t id = symIndex.at((unsigned char)ch);
+    return id < symbols.size() ? id : npos;
   }
+  char symbolAt(uint32_t id) const { return symbols[id]; }
+  unsigned nsymbols() const { return symbols.size(); }
 
-  std::vector<StringToken> parseInputSymbolArray(
-      wrapped_istream &wis) {
-    return parseStringArray(
-        wis, &TMParser::parseInputSymbol);
+  bool isFinal(unsigned state) const {
+    return state < nStates && (flags[state] & FINAL);
+  }
+  /* reaching such a state stops the machine */
+  bool stopsAt(unsigned state) const {
+    return state >= nStates || flags[state];
   }
 
-  std::vector<StringToken> parseTapeSymbolArray(
-      wrapped_istream &wis) {
-    return parseStringArray(
-        wis, &TMParser::parseTapeSymbol);
+  const TransitionInfo &at(uint32_t tid) const {
+    return transitions[tid];
+  }
+  const StepRecord *stepsOf(uint32_t tid) const {
+    return &steps[tid * nTapes];
+  }
+  unsigned nxtStateOf(uint32_t tid) const {
+    return nxtStates[tid];
+  }
+  bool isSweep(uint32_t tid) const {
+    return kinds[tid] & SWEEP;
+  }
+  size_t size() const { return transitions.size(); }
+  unsigned get_nstates() const { return nStates; }
+  const std::vector<TransitionInfo> &
+  get_transitions() const {
+    return transitions;
   }
+};
 
+/* block transition cache of the macro machine. The tape of a
+ * single-tape machine is viewed as blocks of B cells, and
+ * (state, block contents, entry offset) is mapped to what the
+ * machine leaves behind when its head exits the block, so a
+ * block seen before is crossed in one lookup */
+class MacroCache {
 public:
-  TMParser() {}
+  struct Key {
+    uint64_t contents; // dense symbol ids, bits each
+    uint32_t state;
+    uint32_t pos; // head offset in the block
+    bool operator==(const Key &k) const {
+      return contents == k.contents && state == k.state &&
+             pos == k.pos;
+    }
+  };
 
-  void dump() {
-    std::clog << "#Q = {";
-    for (const StringToken &s : states)
-      std::clog << std::string(s) << ", ";
-    std::clog << "}\n";
+  struct Result {
+    uint64_t contents;
+    uint64_t steps;
+    uint32_t state;
+    int32_t pos; // -1 or B once the head has left the block
+  };
 
-    std::clog << "#S = {";
-    for (const StringToken &s : inputSymbolSet)
-      std::clog << std::string(s) << ", ";
-    std::clog << "}\n";
+  enum Outcome { EXIT, STOP, LOOP };
 
-    std::clog << "#G = {";
-    for (const StringToken &s : tapeSymbolSet)
-      std::clog << std::string(s) << ", ";
-    std::clog << "}\n";
+private:
+  struct KeyHash {
+    size_t operator()(const Key &k) const {
+      uint64_t h = k.contents * 0x9e3779b97f4a7c15ull;
+      h ^= (uint64_t(k.state) << 32 | k.pos) +
+           0x632be59bd9b4e019ull + (h << 6) + (h >> 2);
+      return h ^ (h >> 29);
+    }
+  };
 
-    std::clog << "#q0 = ";
-    std::clog << std::string(initState) << "\n";
+  static constexpr size_t max_entries = 1 << 22;
 
-    std::clog << "#B = ";
-    std::clog << std::string(blankSymbol) << "\n";
+  const TransitionTable &delta;
+  unsigned bits = 1;
+  std::unordered_map<Key, Result, KeyHash> map;
 
-    std::clog << "#F = {";
-    for (const StringToken &s : finalStates)
-      std::clog << std::string(s) << ", ";
-    std::clog << "}\n";
+public:
+  /* steps after which a head stuck in one block is assumed
+   * to loop forever, no result has more steps */
+  static constexpr uint64_t max_block_steps = 1 << 20;
 
-    std::clog << "#N = " << nTapes << "\n";
+  unsigned B = 0;
+  uint64_t hits = 0, misses = 0;
 
-    for (const DeltaEntry &e : delta) {
-      for (char ch : e.curState) std::clog << ch;
-      std::clog << " ";
-      for (char ch : e.curSymbols) std::clog << ch;
-      std::clog << " ";
-      for (char ch : e.nxtSymbols) std::clog << ch;
-      std::clog << " ";
-      for (char ch : e.actions) std::clog << ch;
-      std::clog << " ";
-      for (char ch : e.nxtState) std::clog << ch;
-      std::clog << " ";
-      std::clog << "\n";
+  MacroCache(const TransitionTable &delta, unsigned block)
+      : delta(delta) {
+    while ((1u << bits) < delta.nsymbols()) bits++;
+    B = std::min(block ? block : 16u, 64 / bits);
+  }
+
+  /* false if a cell holds a symbol outside the alphabet */
+  bool pack(const char *cells, uint64_t &contents) const {
+    contents = 0;
+    for (unsigned i = 0; i < B; i++) {
+      uint32_t id = delta.symbolId(cells[i]);
+      if (id == TransitionTable::npos) return false;
+      contents |= uint64_t(id) << (bits * i);
     }
+    return true;
   }
 
-  bool validate_input(const std::string &input) {
-    /* ERROR
-     *
-     * Input: 100A1A001
-     * ==================== ERR ====================
-     * error: 'A' was not declared in the set of input
-     * symbols Input: 100A1A001
-     *  		 ^
-     * ==================== END ====================
-     *
-     * CORRECT
-     * Input: 1001001
-     * ==================== RUN ====================
-     * */
-    std::set<char> valid_chars;
-    for (auto &s : inputSymbolSet)
-      valid_chars.insert(s.at(0));
+  void unpack(uint64_t contents, char *cells) const {
+    const uint64_t mask = (1ull << bits) - 1;
+    for (unsigned i = 0; i < B; i++)
+      cells[i] =
+          delta.symbolAt((contents >> (bits * i)) & mask);
+  }
 
-    for (unsigned i = 0; i < input.size(); i++) {
-      char ch = input[i];
-      if (valid_chars.find(ch) != valid_chars.end())
-        continue;
-      if (blankSymbol.size() && ch == blankSymbol.at(0))
-        continue;
+  const Result *find(const Key &key) {
+    auto it = map.find(key);
+    if (it == map.end()) {
+      misses++;
+      return nullptr;
+    }
+    hits++;
+    return &it->second;
+  }
 
-      if (opt::verbose) {
-        /* clang-format off */
-        std::cerr << "Input: " << input << "\n";
-        std::cerr << "==================== ERR ====================\n";
-        std::cerr << "error: '" << ch
-                  << "' was not declared in the set of input symbols\n";
-        std::cerr << "Input: " << input << "\n";
-        for (unsigned j = 0; j < 7 + i; j++) std::cerr << " ";
-        std::cerr << "^\n";
-        std::cerr << "==================== END ====================\n";
+  void insert(const Key &key, const Result &r) {
+    if (map.size() >= max_entries) map.clear();
+    map.emplace(key, r);
+  }
+
+  /* plain stepping inside the block cells until the head
+   * leaves it (EXIT), the machine stops (STOP), or it seems
+   * to loop forever in the block (LOOP) */
+  Outcome simulate(char *cells, unsigned state, int pos,
+      Result &r) const {
+    r.steps = 0;
+    while (pos >= 0 && pos < (int)B) {
+      if (r.steps >= max_block_steps) {
+        r.state = state;
+        r.pos = pos;
+        return LOOP;
+      }
+      uint32_t tid = delta.lookup<1>(state, &cells[pos]);
+      if (tid == TransitionTable::npos) break;
+
+      const TransitionTable::StepRecord *step =
+          delta.stepsOf(tid);
+      cells[pos] = step->sym;
+      pos += step->shift;
+      state = delta.nxtStateOf(tid);
+      r.steps++;
+      if (delta.stopsAt(state)) break;
+    }
+
+    r.state = state;
+    r.pos = pos;
+    bool exited = pos < 0 || pos >= (int)B;
+    return exited && !delta.stopsAt(state) ? EXIT : STOP;
+  }
+};
+
+/* everything parsed from a .tm file, immutable once built and
+ * shared by all machines running it */
+struct Program {
+  unsigned nTapes = 0;
+  char blank = '_';
+  unsigned initState = 0u;
+  std::string inputSymbols; // #S and #B
+  std::vector<std::string> stateStrings;
+  TransitionTable delta;
+
+  /* FNV-1a over everything that affects a run, so that a
+   * snapshot is only restored onto the machine it was taken
+   * of */
+  uint64_t fingerprint() const {
+    uint64_t h = 0xcbf29ce484222325ull;
+    auto add = [&h](const void *p, size_t n) {
+      for (size_t i = 0; i < n; i++) {
+        h ^= ((const unsigned char *)p)[i];
+        h *= 0x100000001b3ull;
+      }
+    };
+    add(&nTapes, sizeof(nTapes));
+    add(&blank, 1);
+    add(&initState, sizeof(initState));
+    for (const std::string &s : stateStrings)
+      add(s.c_str(), s.size() + 1);
+    for (uint32_t tid = 0; tid < delta.size(); tid++) {
+      const TransitionTable::TransitionInfo &info =
+          delta.at(tid);
+      add(&info.curState, sizeof(info.curState));
+      add(info.curSymbols.data(), info.curSymbols.size());
+      for (const auto &step : info.nxtStep) {
+        add(&step.first, 1);
+        add(&step.second, 1);
+      }
+      add(&info.nxtState, sizeof(info.nxtState));
+    }
+    for (unsigned s = 0; s < stateStrings.size(); s++) {
+      bool final = delta.isFinal(s);
+      add(&final, 1);
+    }
+    return h;
+  }
+};
+
+#if HAVE_JIT
+/* translates a Program into x86-64 code at load time. Every
+ * state becomes a block that loads the symbols under the
+ * heads (kept in r8-r11), compares the packed tuple against
+ * the transitions of the state, writes, moves and jumps
+ * straight to the block of the next state. The code returns
+ * when the machine stops, when the step budget in r12 runs
+ * out, or when a head leaves its window, so that the caller
+ * can grow the tape and enter again. */
+class JitCode {
+public:
+  static constexpr unsigned max_tapes = 4;
+
+  struct Context {
+    char *head[max_tapes];
+    /* cells the heads were on, [min, max], widened by the code
+     * as the heads go past them, so that only those cells are
+     * rescanned on exit */
+    char *min[max_tapes];
+    char *max[max_tapes];
+    uint64_t budget; // steps left
+    uint32_t state;
+    char *lo[max_tapes]; // window of each head, [lo, hi)
+    char *hi[max_tapes];
+  };
+
+  enum Exit { STOP = 0, BUDGET = 1, BOUNDS = 2 };
+
+private:
+  static constexpr uint8_t off_min = offsetof(Context, min);
+  static constexpr uint8_t off_max = offsetof(Context, max);
+  // past disp8, addressed with a disp32
+  static constexpr uint32_t off_lo = offsetof(Context, lo);
+  static constexpr uint32_t off_hi = offsetof(Context, hi);
+  static constexpr uint8_t off_budget =
+      offsetof(Context, budget);
+  static constexpr uint8_t off_state =
+      offsetof(Context, state);
+
+  std::vector<uint8_t> code;
+  uint8_t *mem = nullptr;
+  size_t memSize = 0;
+
+  void emit(std::initializer_list<uint8_t> bytes) {
+    code.insert(code.end(), bytes);
+  }
+  void emit32(uint32_t v) {
+    for (unsigned i = 0; i < 4; i++)
+      code.push_back(v >> (8 * i));
+  }
+
+  /* jumps with a rel32 to be patched, returns its position */
+  size_t jcc(uint8_t cc) {
+    emit({0x0f, cc});
+    emit32(0);
+    return code.size() - 4;
+  }
+  size_t jmp() {
+    emit({0xe9});
+    emit32(0);
+    return code.size() - 4;
+  }
+  void patch(size_t pos, size_t target) {
+    uint32_t rel = target - (pos + 4);
+    memcpy(&code[pos], &rel, 4);
+  }
+  void bind(size_t pos) { patch(pos, code.size()); }
+
+  /* mov dword [rbx + state], s; mov eax, reason; jmp exit */
+  void emitExit(unsigned s, Exit reason, size_t exitPos) {
+    emit({0xc7, 0x43, off_state});
+    emit32(s);
+    emit({0xb8});
+    emit32(reason);
+    patch(jmp(), exitPos);
+  }
+
+  JitCode() {}
+
+public:
+  ~JitCode() {
+    if (mem) munmap(mem, memSize);
+  }
+
+  /* nullptr if the program cannot be compiled */
+  static std::unique_ptr<JitCode> compile(
+      const Program &prog);
+
+  Exit enter(Context *ctx) const {
+    return (Exit)((int (*)(Context *))mem)(ctx);
+  }
+};
+
+std::unique_ptr<JitCode> JitCode::compile(
+    const Program &prog) {
+  const unsigned n = prog.nTapes;
+  const TransitionTable &delta = prog.delta;
+  const unsigned nStates = delta.get_nstates();
+  if (n > max_tapes || nStates == 0) return nullptr;
+
+  std::unique_ptr<JitCode> jit(new JitCode());
+  auto &code = jit->code;
+
+  /* prologue: load heads and budget, jump to the state */
+  jit->emit({0x53, 0x41, 0x54, 0x48, 0x89, 0xfb});
+  for (unsigned i = 0; i < n; i++)
+    jit->emit({0x4c, 0x8b, uint8_t(0x43 | i << 3),
+        uint8_t(8 * i)});
+  jit->emit({0x4c, 0x8b, 0x63, off_budget});
+  jit->emit({0x8b, 0x43, off_state});
+  jit->emit({0x48, 0x8d, 0x0d});
+  jit->emit32(0);
+  size_t tablePos = code.size() - 4;
+  jit->emit({0xff, 0x24, 0xc1});
+
+  /* exit: store heads and budget back, reason is in eax */
+  size_t exitPos = code.size();
+  for (unsigned i = 0; i < n; i++)
+    jit->emit({0x4c, 0x89, uint8_t(0x43 | i << 3),
+        uint8_t(8 * i)});
+  jit->emit({0x4c, 0x89, 0x63, off_budget});
+  jit->emit({0x41, 0x5c, 0x5b, 0xc3});
+
+  std::vector<std::vector<uint32_t>> byState(nStates);
+  for (uint32_t tid = 0; tid < delta.size(); tid++)
+    byState[delta.at(tid).curState].push_back(tid);
+
+  std::vector<size_t> blocks(nStates);
+  std::vector<std::pair<size_t, unsigned>> stateJumps;
+  struct Widen {
+    size_t jump, back; // the jb/ja and where it returns to
+    unsigned tape;
+    bool left;
+    unsigned nxt;
+  };
+  std::vector<Widen> widens;
+  for (unsigned s = 0; s < nStates; s++) {
+    blocks[s] = code.size();
+    const std::vector<uint32_t> &tids = byState[s];
+
+    /* test r12, r12; jz budget */
+    jit->emit({0x4d, 0x85, 0xe4});
+    size_t budgetJump = jit->jcc(0x84);
+
+    /* eax = sym0 | sym1 << 8 | ... */
+    if (n == 0) jit->emit({0x31, 0xc0});
+    for (unsigned i = 0; i < n; i++) {
+      if (i == 0) {
+        jit->emit({0x41, 0x0f, 0xb6, 0x00});
+      } else {
+        jit->emit({0x41, 0x0f, 0xb6, uint8_t(0x10 | i)});
+        jit->emit({0xc1, 0xe2, uint8_t(8 * i)});
+        jit->emit({0x09, 0xd0});
+      }
+    }
+
+    std::vector<size_t> matchJumps;
+    for (uint32_t tid : tids) {
+      uint32_t key = 0;
+      const std::string &syms = delta.at(tid).curSymbols;
+      for (unsigned i = 0; i < n; i++)
+        key |= uint32_t((unsigned char)syms[i]) << (8 * i);
+      jit->emit({0x3d});
+      jit->emit32(key);
+      matchJumps.push_back(jit->jcc(0x84));
+    }
+    jit->emitExit(s, STOP, exitPos);
+
+    jit->bind(budgetJump);
+    jit->emitExit(s, BUDGET, exitPos);
+
+    for (unsigned k = 0; k < tids.size(); k++) {
+      jit->bind(matchJumps[k]);
+      const TransitionTable::StepRecord *step =
+          delta.stepsOf(tids[k]);
+      unsigned nxt = delta.nxtStateOf(tids[k]);
+
+      for (unsigned i = 0; i < n; i++) {
+        /* mov byte [r8 + i], sym; inc/dec r8 + i */
+        jit->emit(
+            {0x41, 0xc6, uint8_t(i), uint8_t(step[i].sym)});
+        if (step[i].shift > 0)
+          jit->emit({0x49, 0xff, uint8_t(0xc0 | i)});
+        else if (step[i].shift < 0)
+          jit->emit({0x49, 0xff, uint8_t(0xc8 | i)});
+      }
+      /* dec r12 */
+      jit->emit({0x49, 0xff, 0xcc});
+
+      if (delta.stopsAt(nxt)) {
+        jit->emitExit(nxt, STOP, exitPos);
+        continue;
+      }
+
+      /* cmp r8 + i, [rbx + min/max]; jb/ja widen */
+      for (unsigned i = 0; i < n; i++) {
+        if (step[i].shift == 0) continue;
+        bool left = step[i].shift < 0;
+        jit->emit({0x4c, 0x3b, uint8_t(0x43 | i << 3),
+            uint8_t((left ? off_min : off_max) + 8 * i)});
+        size_t pos = jit->jcc(left ? 0x82 : 0x87);
+        widens.push_back({pos, code.size(), i, left, nxt});
+      }
+      stateJumps.emplace_back(jit->jmp(), nxt);
+    }
+  }
+
+  /* a head past the cells it was on, out of the hot code:
+   * cmp r8 + i, [rbx + lo/hi]; jb/jae bounds;
+   * mov [rbx + min/max], r8 + i; jmp back */
+  for (const Widen &w : widens) {
+    jit->bind(w.jump);
+    jit->emit({0x4c, 0x3b, uint8_t(0x83 | w.tape << 3)});
+    jit->emit32((w.left ? off_lo : off_hi) + 8 * w.tape);
+    size_t bounds = jit->jcc(w.left ? 0x82 : 0x83);
+    jit->emit({0x4c, 0x89, uint8_t(0x43 | w.tape << 3),
+        uint8_t((w.left ? off_min : off_max) + 8 * w.tape)});
+    jit->patch(jit->jmp(), w.back);
+    jit->bind(bounds);
+    jit->emitExit(w.nxt, BOUNDS, exitPos);
+  }
+
+  for (auto &jump : stateJumps)
+    jit->patch(jump.first, blocks[jump.second]);
+
+  /* table of block addresses, filled once mapped */
+  while (code.size() % 8) code.push_back(0xcc);
+  jit->patch(tablePos, code.size());
+  size_t tableOff = code.size();
+  code.resize(code.size() + 8 * nStates);
+
+  jit->memSize = code.size();
+  void *mem = mmap(nullptr, jit->memSize,
+      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+      -1, 0);
+  if (mem == MAP_FAILED) return nullptr;
+  jit->mem = (uint8_t *)mem;
+  for (unsigned s = 0; s < nStates; s++) {
+    uint64_t addr = (uint64_t)(jit->mem + blocks[s]);
+    memcpy(&code[tableOff + 8 * s], &addr, 8);
+  }
+  memcpy(jit->mem, code.data(), code.size());
+  if (mprotect(mem, jit->memSize, PROT_READ | PROT_EXEC))
+    return nullptr;
+  return jit;
+}
+#endif
+
+/* tape of dense symbol ids packed 1, 2, 4 or 8 bits per cell
+ * into 64-bit words, the blank being id 0 so that fresh words
+ * are blank. Scans and fills work on whole words and contents
+ * are decoded a byte at a time */
+class PackedTape {
+  std::vector<uint64_t> words;
+  int64_t origin = 0;       // in cells, a multiple of per
+  int64_t lo = 0, hi = 0;   // written cells, [lo, hi)
+  /* the non-blank cells are in [nlo, nhi), exactly unless
+   * dirty, shrink() narrows it when it is asked for */
+  mutable int64_t nlo = 0, nhi = 0;
+  mutable bool dirty = false;
+  char blank = '_';
+  int64_t index = 0;
+
+  unsigned bits;      // per cell
+  unsigned log2per;   // log2 of cells per word
+  int64_t per;        // cells per word
+  uint64_t mask;      // of one cell
+  uint64_t ones;      // 1 in every cell of a word
+  uint8_t code[256];  // symbol -> id
+  char symbols[256];  // id -> symbol
+  char decode[256][8]; // byte -> the cells it holds
+
+  uint64_t cellAt(int64_t c) const {
+    return (words[c >> log2per] >> ((c & (per - 1)) * bits)) &
+           mask;
+  }
+  void setCell(int64_t c, uint64_t id) {
+    uint64_t &w = words[c >> log2per];
+    unsigned sh = (c & (per - 1)) * bits;
+    w = (w & ~(mask << sh)) | (id << sh);
+  }
+
+  /* make cell i addressable, growing the buffer
+   * geometrically towards i */
+  void reserve(int64_t i) {
+    int64_t left = origin;
+    int64_t right = words.size() * per - origin;
+    int64_t nleft = left, nright = right;
+    if (i < -left)
+      nleft = std::max<int64_t>({-i, 2 * left, 64});
+    if (i >= right)
+      nright = std::max<int64_t>({i + 1, 2 * right, 64});
+    nleft = (nleft + per - 1) & ~(per - 1);
+    nright = (nright + per - 1) & ~(per - 1);
+
+    std::vector<uint64_t> nwords((nleft + nright) / per, 0);
+    std::copy(words.begin(), words.end(),
+        nwords.begin() + (nleft - left) / per);
+    words.swap(nwords);
+    origin = nleft;
+  }
+
+  /* first buffer cell in [c, e) whose id is not that of the
+   * pattern pat, e if none */
+  int64_t scanSame(int64_t c, int64_t e, uint64_t pat) const {
+    uint64_t id = pat & mask;
+    for (; c < e && (c & (per - 1)); c++)
+      if (cellAt(c) != id) return c;
+    for (; c + per <= e; c += per)
+      if (words[c >> log2per] != pat) break;
+    for (; c < e; c++)
+      if (cellAt(c) != id) return c;
+    return e;
+  }
+
+  /* end of the last buffer cell in [b, e) whose id is not
+   * that of pat, b if none */
+  int64_t scanSameBack(
+      int64_t b, int64_t e, uint64_t pat) const {
+    uint64_t id = pat & mask;
+    for (; e > b && (e & (per - 1)); e--)
+      if (cellAt(e - 1) != id) return e;
+    for (; e - per >= b; e -= per)
+      if (words[(e - 1) >> log2per] != pat) break;
+    for (; e > b; e--)
+      if (cellAt(e - 1) != id) return e;
+    return b;
+  }
+
+  void fillCells(int64_t c, int64_t e, uint64_t id) {
+    for (; c < e && (c & (per - 1)); c++) setCell(c, id);
+    for (; c + per <= e; c += per)
+      words[c >> log2per] = id * ones;
+    for (; c < e; c++) setCell(c, id);
+  }
+
+  int64_t skipBlank(int64_t l, int64_t r) const {
+    return scanSame(l + origin, r + origin, 0) - origin;
+  }
+  int64_t skipBlankBack(int64_t l, int64_t r) const {
+    return scanSameBack(l + origin, r + origin, 0) - origin;
+  }
+
+  /* narrow [nlo, nhi) down to the non-blank cells */
+  void shrink() const {
+    if (!dirty) return;
+    nlo = skipBlank(nlo, nhi);
+    nhi = skipBlankBack(nlo, nhi);
+    dirty = false;
+  }
+
+  /* cells [l, r) were all set to id */
+  void touched(int64_t l, int64_t r, uint64_t id) {
+    lo = std::min(lo, l);
+    hi = std::max(hi, r);
+    if (id) {
+      bool any = nlo < nhi;
+      nlo = any ? std::min(nlo, l) : l;
+      nhi = any ? std::max(nhi, r) : r;
+    } else if (nlo < nhi && l < nhi && r > nlo &&
+               (l <= nlo || r >= nhi)) {
+      dirty = true; // an edge went blank
+    }
+  }
+
+  void write(int64_t i, uint64_t id) {
+    if ((uint64_t)(i + origin) >= (uint64_t)words.size() * per)
+      reserve(i);
+    setCell(i + origin, id);
+    touched(i, i + 1, id);
+  }
+
+public:
+  PackedTape(char blank, const TransitionTable &delta)
+      : blank(blank) {
+    /* the blank first, then the rest of the alphabet */
+    unsigned n = 0;
+    memset(code, 0, sizeof(code));
+    symbols[n++] = blank;
+    for (unsigned k = 0; k < delta.nsymbols(); k++) {
+      char ch = delta.symbolAt(k);
+      if (ch == blank || n == 256) continue;
+      code[(unsigned char)ch] = n;
+      symbols[n++] = ch;
+    }
+
+    bits = n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+    per = 64 / bits;
+    log2per = __builtin_ctz(per);
+    mask = (1ull << bits) - 1;
+    ones = ~0ull / mask;
+    for (unsigned b = 0; b < 256; b++)
+      for (unsigned k = 0; k < 8 / bits; k++) {
+        unsigned id = (b >> (k * bits)) & mask;
+        decode[b][k] = id < n ? symbols[id] : blank;
+      }
+  }
+
+  int64_t begin() const { return lo; }
+  int64_t end() const { return hi; }
+  /* bounds of the non-blank cells, cbegin() >= cend() if the
+   * tape is blank */
+  int64_t cbegin() const {
+    shrink();
+    return nlo < nhi ? nlo : hi;
+  }
+  int64_t cend() const {
+    shrink();
+    return nlo < nhi ? nhi : lo;
+  }
+
+  char get(int64_t i) const {
+    uint64_t c = i + origin;
+    if (c >= (uint64_t)words.size() * per) return blank;
+    return symbols[cellAt(c)];
+  }
+  char get() const { return get(index); }
+  int64_t get_index() const { return index; }
+
+  void set(const std::string &s) {
+    fillCells(origin, words.size() * per, 0);
+    if (lo >= 0) lo = 0;
+    hi = 0;
+    nhi = std::min<int64_t>(nhi, 0);
+    dirty = true;
+    for (unsigned i = 0; i < s.size(); i++)
+      write(i, code[(unsigned char)s[i]]);
+  }
+
+  /* blank the tape and rewind the head, the buffer is kept
+   * for the next run */
+  void clear() {
+    std::fill(words.begin(), words.end(), 0);
+    lo = hi = nlo = nhi = 0;
+    dirty = false;
+    index = 0;
+  }
+
+  void restore(int64_t at, const char *cells, int64_t n,
+      int64_t head) {
+    if (n) {
+      ensure(at);
+      ensure(at + n - 1);
+      for (int64_t j = 0; j < n; j++)
+        setCell(at + j + origin, code[(unsigned char)cells[j]]);
+      lo = std::min(lo, at);
+      hi = std::max(hi, at + n);
+      nlo = skipBlank(at, at + n);
+      nhi = skipBlankBack(nlo, at + n);
+      dirty = false;
+    }
+    index = head;
+  }
+
+  void setAndMove(char ch, char dir) {
+    setAndShift(ch, dir == 'l' ? -1 : (dir == 'r' ? 1 : 0));
+  }
+
+  void setAndShift(char ch, int shift) {
+    write(index, code[(unsigned char)ch]);
+    index += shift;
+  }
+
+  /* number of cells equal to ch from the head on in the
+   * direction of shift, counting at most limit cells and only
+   * those inside the buffer */
+  int64_t runLength(char ch, int shift, int64_t limit) const {
+    int64_t c = index + origin, size = words.size() * per;
+    if (c < 0 || c >= size) return 0;
+    uint64_t pat = code[(unsigned char)ch] * ones;
+    if (shift > 0)
+      return scanSame(c, c + std::min(limit, size - c), pat) -
+             c;
+    int64_t b = c + 1 - std::min(limit, c + 1);
+    return c + 1 - scanSameBack(b, c + 1, pat);
+  }
+
+  /* write ch to k cells from the head on while moving in the
+   * direction of shift */
+  void fill(char ch, int shift, int64_t k) {
+    uint64_t id = code[(unsigned char)ch];
+    int64_t l = shift > 0 ? index : index - k + 1;
+    if (l + origin < 0) reserve(l);
+    if (l + k + origin > (int64_t)words.size() * per)
+      reserve(l + k - 1);
+    fillCells(l + origin, l + k + origin, id);
+    touched(l, l + k, id);
+    index += shift * k;
+  }
+
+  /* the head stays on its cell for k steps of a skipped run */
+  void stay(int64_t) {}
+
+  /* make cell i addressable, so that runLength() can count
+   * up to it */
+  void ensure(int64_t i) {
+    if ((uint64_t)(i + origin) >= (uint64_t)words.size() * per)
+      reserve(i);
+  }
+
+  /* bytes held for cells */
+  size_t memory() const {
+    return words.capacity() * sizeof(uint64_t);
+  }
+
+  std::string get_contents() const {
+    shrink();
+    if (nlo >= nhi) return "";
+    std::string ret;
+    ret.reserve(nhi - nlo);
+    const int64_t cpb = 8 / bits; // cells per byte
+    int64_t c = nlo + origin, e = nhi + origin;
+    for (; c < e && c % cpb; c++)
+      ret.push_back(symbols[cellAt(c)]);
+    for (; c + cpb <= e; c += cpb) {
+      unsigned byte =
+          (words[c >> log2per] >> ((c & (per - 1)) * bits)) &
+          0xff;
+      ret.append(decode[byte], cpb);
+    }
+    for (; c < e; c++) ret.push_back(symbols[cellAt(c)]);
+    return ret;
+  }
+};
+
+/* head statistics of one tape (--heatmap). Visits are
+ * counted per bucket of 2^shift cells, and buckets double in
+ * width whenever the visited range would need more than
+ * max_buckets of them. Sweeps are the runs of moves in one
+ * direction between reversals, counted in log2 length
+ * classes */
+struct TapeHeat {
+  static constexpr size_t max_buckets = 1 << 12;
+
+  unsigned shift = 0;
+  int64_t first = 0; // bucket number of buckets[0]
+  std::vector<uint64_t> buckets;
+  uint64_t visits = 0, moves = 0, reversals = 0;
+  uint64_t sweeps[64] = {};
+  int dir = 0;
+  uint64_t run = 0; // cells moved in dir so far
+
+  void coarsen() {
+    int64_t f = first >> 1;
+    int64_t e = (first + (int64_t)buckets.size() - 1) >> 1;
+    std::vector<uint64_t> c(e - f + 1);
+    for (size_t j = 0; j < buckets.size(); j++)
+      c[((first + (int64_t)j) >> 1) - f] += buckets[j];
+    buckets.swap(c);
+    first = f;
+    shift++;
+  }
+
+  /* make the bucket of cell i exist */
+  void cover(int64_t i) {
+    int64_t b = i >> shift;
+    if (buckets.empty()) {
+      first = b;
+      buckets.assign(1, 0);
+      return;
+    }
+    int64_t end = first + (int64_t)buckets.size();
+    int64_t lo = std::min(first, b), hi = std::max(end, b + 1);
+    if (hi - lo > (int64_t)max_buckets) {
+      coarsen();
+      cover(i);
+      return;
+    }
+    buckets.insert(buckets.begin(), first - lo, 0);
+    buckets.resize(hi - lo);
+    first = lo;
+  }
+
+  void visit(int64_t i) {
+    uint64_t b = (i >> shift) - first;
+    if (b >= buckets.size()) {
+      cover(i);
+      b = (i >> shift) - first;
+    }
+    buckets[b]++;
+    visits++;
+  }
+
+  /* one visit to each cell of [l, r) */
+  void visit(int64_t l, int64_t r) {
+    cover(l);
+    cover(r - 1);
+    for (int64_t i = l; i < r;) {
+      int64_t next = std::min(r, ((i >> shift) + 1) << shift);
+      buckets[(i >> shift) - first] += next - i;
+      i = next;
+    }
+    visits += r - l;
+  }
+
+  /* n more visits to cell i */
+  void revisit(int64_t i, uint64_t n) {
+    visit(i);
+    buckets[(i >> shift) - first] += n - 1;
+    visits += n - 1;
+  }
+
+  void move(int s, uint64_t k) {
+    if (!s) return;
+    moves += k;
+    if (s == dir) {
+      run += k;
+      return;
+    }
+    if (dir) reversals++;
+    stop();
+    dir = s;
+    run = k;
+  }
+
+  /* ends the current sweep */
+  void stop() {
+    if (run) sweeps[63 - __builtin_clzll(run)]++;
+    dir = 0;
+    run = 0;
+  }
+};
+
+/* TapeT that counts the accesses of the step loop into a
+ * TapeHeat, a separate type so that uninstrumented tapes do
+ * not pay for it */
+template <class TapeT>
+class HeatTape : public TapeT {
+  TapeHeat h;
+
+public:
+  using TapeT::TapeT;
+  using TapeT::get;
+
+  char get() {
+    h.visit(this->get_index());
+    return TapeT::get();
+  }
+
+  void setAndMove(char ch, char dir) {
+    setAndShift(ch, dir == 'l' ? -1 : (dir == 'r' ? 1 : 0));
+  }
+
+  void setAndShift(char ch, int shift) {
+    h.move(shift, 1);
+    TapeT::setAndShift(ch, shift);
+  }
+
+  /* the cell under the head was counted by the get() of the
+   * step, the run reads the k - 1 cells after it */
+  void fill(char ch, int shift, int64_t k) {
+    int64_t i = this->get_index();
+    int64_t l = shift > 0 ? i + 1 : i - k + 1;
+    if (k > 1) h.visit(l, l + k - 1);
+    h.move(shift, k);
+    TapeT::fill(ch, shift, k);
+  }
+
+  /* the get() of the step counted the first of the k */
+  void stay(int64_t k) {
+    if (k > 1) h.revisit(this->get_index(), k - 1);
+  }
+
+  /* statistics are kept over all runs */
+  void clear() {
+    h.stop();
+    TapeT::clear();
+  }
+
+  const TapeHeat &heat() const { return h; }
+};
+
+/* copy of a machine configuration, the non-blank cells of
+ * every tape from starts[i] on */
+struct Configuration {
+  unsigned state = 0;
+  uint64_t steps = 0;
+  std::vector<int64_t> heads, starts;
+  std::vector<std::string> contents;
+
+  template <class TapeT>
+  void capture(const std::vector<TapeT> &tapes, unsigned state) {
+    this->state = state;
+    heads.resize(tapes.size());
+    starts.resize(tapes.size());
+    contents.resize(tapes.size());
+    for (unsigned i = 0; i < tapes.size(); i++) {
+      heads[i] = tapes[i].get_index();
+      contents[i] = tapes[i].get_contents();
+      starts[i] = contents[i].size() ? tapes[i].cbegin() : 0;
+    }
+  }
+
+  /* the same state, heads and cells, whatever the steps */
+  bool sameAs(const Configuration &c) const {
+    return state == c.state && heads == c.heads &&
+           starts == c.starts && contents == c.contents;
+  }
+};
+
+/* spots runs that provably never halt, checked after every
+ * step with --detect.
+ *
+ * Cycles: the configuration (state, heads, tapes) is hashed,
+ * with an incrementally kept Zobrist-style hash of each tape,
+ * and compared against a configuration saved at steps that
+ * are powers of two (Brent). A hash match is verified exactly
+ * against the saved configuration.
+ *
+ * Drift, single tape only: a record is taken whenever the
+ * head moves onto a cell beyond which the tape is all blank.
+ * If two records have the same state and the cells the head
+ * visited in between read the same relative to the head, the
+ * machine repeats that stretch translated forever */
+template <class TapeT>
+class DivergenceDetector {
+  /* positions are multiplied by the direction, so that the
+   * head always drifts towards larger positions */
+  struct Record {
+    int64_t pos;
+    int64_t lowest; // of the head until the next record
+    unsigned state;
+    std::string window; // cells (pos - window_size, pos]
+  };
+  static constexpr int64_t window_size = 256;
+  static constexpr size_t max_records = 256;
+
+  char blank;
+  std::vector<uint64_t> tapeHash;
+
+  Configuration saved;
+  uint64_t savedHash = 0;
+  uint64_t power = 1, lam = 0;
+
+  std::vector<Record> records[2];
+  size_t latest[2] = {0, 0};
+
+  static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+  }
+
+  uint64_t cellHash(int64_t i, char ch) const {
+    if (ch == blank) return 0;
+    return mix((uint64_t)i * 256 + (unsigned char)ch);
+  }
+
+  uint64_t configHash(const std::vector<TapeT> &tapes,
+      unsigned state) const {
+    uint64_t h = mix(state);
+    for (unsigned i = 0; i < tapes.size(); i++)
+      h ^= mix(tapeHash[i] + i) ^
+           mix(tapes[i].get_index() * 64 + i + 1);
+    return h;
+  }
+
+  bool cycles(const std::vector<TapeT> &tapes, unsigned state) {
+    uint64_t h = configHash(tapes, state);
+    if (h == savedHash && state == saved.state) {
+      Configuration now;
+      now.capture(tapes, state);
+      if (now.sameAs(saved)) return true;
+    }
+    if (++lam == power) {
+      saved.capture(tapes, state);
+      savedHash = h;
+      power *= 2;
+      lam = 0;
+    }
+    return false;
+  }
+
+  /* cells beyond the head, the head included, are blank */
+  static bool atEdge(const TapeT &t, int dir) {
+    if (t.cbegin() >= t.cend()) return true;
+    return dir > 0 ? t.get_index() >= t.cend()
+                   : t.get_index() < t.cbegin();
+  }
+
+  bool drifts(const TapeT &t, unsigned state, int shift) {
+    for (int k = 0; k < 2; k++) {
+      int dir = k ? -1 : 1;
+      std::vector<Record> &recs = records[k];
+      int64_t pos = t.get_index() * dir;
+      if (recs.size())
+        recs[latest[k]].lowest =
+            std::min(recs[latest[k]].lowest, pos);
+      if (shift != dir || !atEdge(t, dir)) continue;
+
+      int64_t low = pos;
+      for (size_t n = 0; n < recs.size(); n++) {
+        const Record &r =
+            recs[(latest[k] + recs.size() - n) % recs.size()];
+        low = std::min(low, r.lowest);
+        int64_t first = r.pos - window_size + 1;
+        if (r.state != state || low < first) continue;
+        /* drifting back over cells it wrote is no repeat, the
+         * translated stretch would read them */
+        if (pos < r.pos) continue;
+
+        int64_t d = pos - r.pos, x = r.pos;
+        for (; x >= low; x--)
+          if (r.window[x - first] != t.get((x + d) * dir))
+            break;
+        if (x < low) return true;
+      }
+
+      Record r{pos, pos, state, std::string(window_size, 0)};
+      for (int64_t x = 0; x < window_size; x++)
+        r.window[x] = t.get((pos - window_size + 1 + x) * dir);
+      if (recs.size() < max_records) {
+        latest[k] = recs.size();
+        recs.push_back(std::move(r));
+      } else {
+        latest[k] = (latest[k] + 1) % max_records;
+        recs[latest[k]] = std::move(r);
+      }
+    }
+    return false;
+  }
+
+public:
+  DivergenceDetector(const std::vector<TapeT> &tapes,
+      char blank)
+      : blank(blank), tapeHash(tapes.size(), 0) {
+    for (unsigned i = 0; i < tapes.size(); i++)
+      for (int64_t j = tapes[i].cbegin(); j < tapes[i].cend();
+           j++)
+        tapeHash[i] ^= cellHash(j, tapes[i].get(j));
+  }
+
+  /* before tape i writes ch over the cell under its head */
+  void write(unsigned i, const TapeT &t, char ch) {
+    tapeHash[i] ^= cellHash(t.get_index(), t.get()) ^
+                   cellHash(t.get_index(), ch);
+  }
+
+  /* after a step that moved the first head by shift */
+  bool diverges(const std::vector<TapeT> &tapes,
+      unsigned state, int shift) {
+    if (cycles(tapes, state)) return true;
+    return tapes.size() == 1 && drifts(tapes[0], state, shift);
+  }
+};
+
+#if HAVE_MMAP
+/* binary snapshot of a machine configuration: a Header, then
+ * for every tape a TapeHeader followed by its non-blank cells.
+ * Cells go out in one write per tape and are read back through
+ * a read-only mapping of the file */
+class SnapshotFile {
+  int fd = -1;
+  char *base = nullptr;
+  size_t len = 0;
+
+public:
+  struct Header {
+    char magic[8];
+    uint64_t program; // Program::fingerprint()
+    uint64_t steps;
+    uint32_t state;
+    uint32_t nTapes;
+  };
+  struct TapeHeader {
+    int64_t head;
+    int64_t start; // cell of the first byte
+    int64_t length;
+  };
+  static constexpr char magic[8] = {
+      'T', 'M', 'S', 'N', 'A', 'P', 0, 1};
+
+  /* writes the chunks to a temporary file that is synced and
+   * renamed over path, an interrupted save leaves the former
+   * snapshot intact */
+  static bool write(const std::string &path,
+      const std::vector<std::pair<const char *, size_t>>
+          &chunks) {
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+        0644);
+    if (fd < 0) return false;
+    bool ok = true;
+    for (const auto &chunk : chunks) {
+      const char *p = chunk.first;
+      for (size_t n = chunk.second; ok && n > 0;) {
+        ssize_t k = ::write(fd, p, n);
+        if (k < 0 && errno == EINTR) continue;
+        ok = k > 0;
+        p += k;
+        n -= k;
+      }
+    }
+    ok = ok && fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (ok) ok = rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) unlink(tmp.c_str());
+    return ok;
+  }
+
+  SnapshotFile(const std::string &path) {
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size <= 0) return;
+    void *mem = mmap(nullptr, size, PROT_READ, MAP_PRIVATE,
+        fd, 0);
+    if (mem == MAP_FAILED) return;
+    base = (char *)mem;
+    len = size;
+  }
+  SnapshotFile(const SnapshotFile &) = delete;
+  ~SnapshotFile() {
+    if (base) munmap(base, len);
+    if (fd >= 0) close(fd);
+  }
+
+  const char *data() const { return base; }
+  size_t size() const { return len; }
+};
+#endif
+
+/* binary step log (--trace). After a header the file is a
+ * sequence of blocks, each a keyframe, the full configuration
+ * at its first step, then the number of steps and of bytes
+ * that follow and the id of every transition taken as a LEB128
+ * varint, mostly one byte. Blocks are written whole through a
+ * large stdio buffer, and the byte count lets a reader skip
+ * the steps of a block it does not render */
+class TraceWriter {
+  FILE *f = nullptr;
+  std::vector<char> buf;
+  uint64_t every;
+  bool inBlock = false;
+  uint64_t count = 0; // steps in the block
+  std::string key;    // keyframe of the block
+  std::string tids;
+
+  template <class T>
+  static void put(std::string &s, T v) {
+    s.append((const char *)&v, sizeof(v));
+  }
+
+  void flushBlock() {
+    put(key, count);
+    put(key, uint64_t(tids.size()));
+    fwrite(key.data(), 1, key.size(), f);
+    fwrite(tids.data(), 1, tids.size(), f);
+    tids.clear();
+    inBlock = false;
+  }
+
+public:
+  static constexpr char magic[8] = {
+      'T', 'M', 'T', 'R', 'A', 'C', 'E', 1};
+
+  TraceWriter(uint64_t every)
+      : buf(1 << 20), every(std::max<uint64_t>(every, 1)) {}
+  TraceWriter(const TraceWriter &) = delete;
+  ~TraceWriter() { finish(); }
+
+  bool open(const char *path, uint64_t program,
+      uint32_t nTapes) {
+    f = fopen(path, "wb");
+    if (!f) return false;
+    setvbuf(f, buf.data(), _IOFBF, buf.size());
+    std::string h(magic, sizeof(magic));
+    put(h, program);
+    put(h, every);
+    put(h, nTapes);
+    fwrite(h.data(), 1, h.size(), f);
+    return true;
+  }
+
+  /* a keyframe goes before the next step */
+  bool due() const { return !inBlock || count == every; }
+
+  void keyframe(const Configuration &c) {
+    if (inBlock) flushBlock();
+    key.clear();
+    put(key, c.steps);
+    put(key, uint32_t(c.state));
+    for (unsigned i = 0; i < c.heads.size(); i++) {
+      put(key, c.heads[i]);
+      put(key, c.starts[i]);
+      put(key, int64_t(c.contents[i].size()));
+      key += c.contents[i];
+    }
+    inBlock = true;
+    count = 0;
+  }
+
+  void step(uint32_t tid) {
+    for (; tid >= 0x80; tid >>= 7)
+      tids.push_back(char(tid | 0x80));
+    tids.push_back(char(tid));
+    count++;
+  }
+
+  /* false if a write failed */
+  bool finish() {
+    if (!f) return true;
+    if (inBlock) flushBlock();
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    f = nullptr;
+    return ok;
+  }
+};
+
+/* execution profile (--profile). Transition hits live in a
+ * flat array indexed by transition id, which is all the step
+ * loop touches; state residency and tape growth come from
+ * samples taken every sample_period steps, which read the
+ * clock and attribute the time since the last sample to the
+ * state the machine is in */
+class Profiler {
+  using Clock = std::chrono::steady_clock;
+
+  struct Growth {
+    uint64_t step, cells;
+  };
+
+  const Program &prog;
+  Clock::time_point last;
+  std::vector<Growth> growth; // thinned to max_growth
+
+  static constexpr size_t max_growth = 4096;
+
+  static std::string quote(const std::string &s) {
+    std::string ret = "\"";
+    for (char ch : s) {
+      if (ch == '"' || ch == '\\') ret.push_back('\\');
+      ret.push_back(ch);
+    }
+    return ret + "\"";
+  }
+
+  std::string describe(uint32_t tid) const {
+    const TransitionTable::TransitionInfo &info =
+        prog.delta.at(tid);
+    std::string write, move;
+    for (const auto &step : info.nxtStep) {
+      write.push_back(step.first);
+      move.push_back(step.second);
+    }
+    return prog.stateStrings[info.curState] + " " +
+           info.curSymbols + " " + write + " " + move + " " +
+           prog.stateStrings[info.nxtState];
+  }
+
+public:
+  static constexpr uint32_t sample_period = 4096;
+
+  std::vector<uint64_t> hits;   // per transition id
+  std::vector<double> seconds;  // per state
+
+  Profiler(const Program &prog)
+      : prog(prog), last(Clock::now()),
+        hits(prog.delta.size()),
+        seconds(prog.stateStrings.size()) {}
+
+  void sample(unsigned state, uint64_t step, uint64_t cells) {
+    Clock::time_point now = Clock::now();
+    seconds[state] +=
+        std::chrono::duration<double>(now - last).count();
+    last = now;
+
+    if (growth.size() && growth.back().cells >= cells) return;
+    if (growth.size() == max_growth) {
+      for (size_t i = 0; i < max_growth / 2; i++)
+        growth[i] = growth[2 * i + 1];
+      growth.resize(max_growth / 2);
+    }
+    growth.push_back(Growth{step, cells});
+  }
+
+  /* a new run starts from an empty tape */
+  void restart() {
+    last = Clock::now();
+    growth.clear();
+  }
+
+  void writeJson(std::ostream &os) const {
+    const TransitionTable &delta = prog.delta;
+    std::vector<uint32_t> order(hits.size());
+    for (uint32_t tid = 0; tid < order.size(); tid++)
+      order[tid] = tid;
+    std::stable_sort(order.begin(), order.end(),
+        [this](uint32_t a, uint32_t b) {
+          return hits[a] > hits[b];
+        });
+
+    uint64_t total = 0;
+    std::vector<uint64_t> stateSteps(seconds.size());
+    std::vector<uint64_t> travel(prog.nTapes);
+    for (uint32_t tid = 0; tid < hits.size(); tid++) {
+      total += hits[tid];
+      stateSteps[delta.at(tid).curState] += hits[tid];
+      const TransitionTable::StepRecord *step =
+          delta.stepsOf(tid);
+      for (unsigned i = 0; i < prog.nTapes; i++)
+        if (step[i].shift) travel[i] += hits[tid];
+    }
+
+    os << "{\n  \"steps\": " << total << ",\n";
+    os << "  \"transitions\": [";
+    const char *sep = "\n";
+    for (uint32_t tid : order) {
+      if (!hits[tid]) break;
+      const TransitionTable::TransitionInfo &info =
+          delta.at(tid);
+      std::string write, move;
+      for (const auto &step : info.nxtStep) {
+        write.push_back(step.first);
+        move.push_back(step.second);
+      }
+      os << sep << "    {\"id\": " << tid << ", \"state\": "
+         << quote(prog.stateStrings[info.curState])
+         << ", \"read\": " << quote(info.curSymbols)
+         << ", \"write\": " << quote(write)
+         << ", \"move\": " << quote(move) << ", \"next\": "
+         << quote(prog.stateStrings[info.nxtState])
+         << ", \"hits\": " << hits[tid] << "}";
+      sep = ",\n";
+    }
+    os << "\n  ],\n  \"states\": [";
+    sep = "\n";
+    for (unsigned s = 0; s < seconds.size(); s++) {
+      os << sep << "    {\"state\": "
+         << quote(prog.stateStrings[s])
+         << ", \"steps\": " << stateSteps[s]
+         << ", \"seconds\": " << seconds[s] << "}";
+      sep = ",\n";
+    }
+    os << "\n  ],\n  \"tapes\": [";
+    sep = "\n";
+    for (unsigned i = 0; i < prog.nTapes; i++) {
+      os << sep << "    {\"tape\": " << i
+         << ", \"travel\": " << travel[i] << "}";
+      sep = ",\n";
+    }
+    os << "\n  ],\n  \"growth\": [";
+    sep = "";
+    for (const Growth &g : growth) {
+      os << sep << "[" << g.step << ", " << g.cells << "]";
+      sep = ", ";
+    }
+    os << "]\n}\n";
+  }
+
+  /* the n transitions taking most steps */
+  void writeTable(std::ostream &os, size_t n) const {
+    uint64_t total = 0;
+    std::vector<uint32_t> order;
+    for (uint32_t tid = 0; tid < hits.size(); tid++) {
+      total += hits[tid];
+      if (hits[tid]) order.push_back(tid);
+    }
+    std::stable_sort(order.begin(), order.end(),
+        [this](uint32_t a, uint32_t b) {
+          return hits[a] > hits[b];
+        });
+    if (order.size() > n) order.resize(n);
+
+    os << "hottest transitions of " << total << " steps\n";
+    for (uint32_t tid : order) {
+      char line[64];
+      snprintf(line, sizeof(line), "%16llu %6.2f%%  ",
+          (unsigned long long)hits[tid],
+          100.0 * hits[tid] / total);
+      os << line << describe(tid) << "\n";
+    }
+  }
+};
+
+/* execution context of a Program, cheap to create so that
+ * every thread can have its own. TapeT is the tape
+ * representation, the JIT and the macro machine need the
+ * flat Tape */
+template <class TapeT>
+class BasicTuringMachine {
+  std::shared_ptr<const Program> prog;
+  std::vector<TapeT> tapes;
+
+  unsigned state = 0u;
+  uint64_t nr_steps = 0u;
+
+  using TransitionInfo = TransitionTable::TransitionInfo;
+  const TransitionTable *delta;
+
+  /* symbols under the heads, reused by every step */
+  std::vector<char> symbuf;
+
+#if HAVE_JIT
+  std::shared_ptr<JitCode> jit;
+  bool jitTried = false;
+#endif
+  std::shared_ptr<MacroCache> macro;
+  TraceWriter *trace = nullptr;
+  Profiler *profile = nullptr;
+
+public:
+  /* why the last run stopped */
+  enum Stop {
+    HALTED,
+    DIVERGES,
+    STEP_LIMIT,
+    TIMEOUT,
+    TAPE_LIMIT,
+    TERMINATED
+  };
+
+  /* steps between budget checks, long enough to keep clock
+   * reads out of the step loop */
+  static constexpr uint64_t check_interval = 1 << 20;
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  Stop stopped = HALTED;
+  /* budgets are checked once nr_steps reaches nextCheck, which
+   * never exceeds maxSteps */
+  uint64_t nextCheck = 0;
+  uint64_t maxSteps = UINT64_MAX;
+  Clock::time_point started;
+  Clock::time_point lastBeat;
+  uint64_t lastBeatSteps = 0;
+  Clock::time_point lastSnapshot;
+
+  static double secondsSince(
+      Clock::time_point t, Clock::time_point now) {
+    return std::chrono::duration<double>(now - t).count();
+  }
+
+  uint64_t tapeCells() const {
+    uint64_t n = 0;
+    for (const TapeT &t : tapes) n += t.end() - t.begin();
+    return n;
+  }
+
+  void printHeartbeat(Clock::time_point now) {
+    double secs = secondsSince(lastBeat, now);
+    double rate =
+        secs > 0 ? (nr_steps - lastBeatSteps) / secs : 0;
+    std::cerr << "heartbeat: step " << nr_steps << ", "
+              << uint64_t(rate) << " steps/s, " << tapeCells()
+              << " tape cells\n";
+    lastBeat = now;
+    lastBeatSteps = nr_steps;
+  }
+
+  void startBudgets() {
+    started = lastBeat = lastSnapshot = Clock::now();
+    lastBeatSteps = nr_steps;
+    maxSteps = opt::max_steps ? opt::max_steps : UINT64_MAX;
+    nextCheck = std::min(nr_steps + check_interval, maxSteps);
+  }
+
+  /* called once nr_steps reaches nextCheck with a transition
+   * to take, true if a budget ran out and the run stops */
+  bool overBudget() {
+    Clock::time_point now = Clock::now();
+    if (nr_steps >= maxSteps)
+      stopped = STEP_LIMIT;
+    else if (opt::timeout > 0 &&
+             secondsSince(started, now) >= opt::timeout)
+      stopped = TIMEOUT;
+    else if (opt::max_tape_cells &&
+             tapeCells() > opt::max_tape_cells)
+      stopped = TAPE_LIMIT;
+    else if (terminate_pending)
+      stopped = TERMINATED;
+    nextCheck = std::min(nr_steps + check_interval, maxSteps);
+
+    if (heartbeat_pending ||
+        (opt::heartbeat > 0 &&
+            secondsSince(lastBeat, now) >= opt::heartbeat)) {
+      heartbeat_pending = 0;
+      printHeartbeat(now);
+    }
+
+    /* a stopped run is saved so that it can be resumed with a
+     * larger budget */
+    if (opt::checkpoint &&
+        (stopped != HALTED ||
+            (opt::checkpoint_every > 0 &&
+                secondsSince(lastSnapshot, now) >=
+                    opt::checkpoint_every))) {
+      if (!save(opt::checkpoint))
+        std::cerr << "cannot write snapshot '"
+                  << opt::checkpoint << "'\n";
+      lastSnapshot = now;
+    }
+    return stopped != HALTED;
+  }
+
+  /* the machine has a transition to take */
+  bool canStep() {
+    return delta->lookup(state, readCurSymbols()) !=
+           TransitionTable::npos;
+  }
+
+public:
+  BasicTuringMachine(std::shared_ptr<const Program> prog)
+      : prog(prog), state(prog->initState),
+        delta(&prog->delta), symbuf(prog->nTapes) {
+    for (unsigned i = 0; i < prog->nTapes; i++)
+      if constexpr (std::is_constructible<TapeT, char,
+                        const TransitionTable &>::value)
+        tapes.emplace_back(prog->blank, prog->delta);
+      else
+        tapes.emplace_back(prog->blank);
+  }
+
+  const Program &get_program() const { return *prog; }
+  uint64_t get_steps() const { return nr_steps; }
+
+  void set_input(const std::string &s) {
+    if (tapes.size()) tapes.at(0).set(s);
+  }
+
+  /* back to the initial configuration without re-parsing,
+   * tape buffers are reused */
+  void reset() {
+    for (auto &tape : tapes) tape.clear();
+    state = prog->initState;
+    nr_steps = 0;
+    stopped = HALTED;
+  }
+
+  Stop get_stop() const { return stopped; }
+  /* the last run was stopped by --detect as never halting */
+  bool diverges() const { return stopped == DIVERGES; }
+
+  /* printed instead of the result of a run that did not halt,
+   * nullptr if it halted */
+  const char *verdict() const {
+    switch (stopped) {
+    case DIVERGES: return "diverges";
+    case STEP_LIMIT: return "out of steps";
+    case TIMEOUT: return "timeout";
+    case TAPE_LIMIT: return "out of tape";
+    case TERMINATED: return "terminated";
+    default: return nullptr;
+    }
+  }
+
+  void get_config(Configuration &c) const {
+    c.capture(tapes, state);
+    c.steps = nr_steps;
+  }
+
+  void set_config(const Configuration &c) {
+    reset();
+    for (unsigned i = 0; i < tapes.size(); i++)
+      tapes[i].restore(c.starts[i], c.contents[i].data(),
+          c.contents[i].size(), c.heads[i]);
+    state = c.state;
+    nr_steps = c.steps;
+  }
+
+  unsigned get_state() const { return state; }
+  const TapeT &get_tape(unsigned i) const { return tapes[i]; }
+
+  /* bytes the tapes hold, they do not shrink within a run */
+  size_t tapeMemory() const {
+    size_t n = 0;
+    for (const TapeT &t : tapes) n += t.memory();
+    return n;
+  }
+
+  /* runs record every step to w, nullptr for none */
+  void set_trace(TraceWriter *w) { trace = w; }
+
+  /* runs count into p, nullptr for none */
+  void set_profile(Profiler *p) { profile = p; }
+
+  /* one plain step, the id of the transition taken or npos if
+   * there is none */
+  uint32_t takeStep() {
+    uint32_t tid = delta->lookup(state, readCurSymbols());
+    if (tid != TransitionTable::npos) applyStep(tid);
+    return tid;
+  }
+
+  /* up to n steps the way runLoop takes them, for the
+   * debugger. Each run of k steps of one transition is passed
+   * to log(tid, k), and a sweep is taken at once if
+   * skippable(tid) tells that until() cannot hold inside it.
+   * Stops after a step into a final state or where until()
+   * holds, and when there is no transition to take. Returns
+   * the steps taken */
+  template <class Log, class Until, class Skippable>
+  uint64_t stepBatch(uint64_t n, Log &&log, Until &&until,
+      Skippable &&skippable) {
+    const unsigned nt = tapes.size();
+    char *syms = symbuf.data();
+    uint64_t taken = 0, run = 0;
+    uint32_t last = TransitionTable::npos;
+    while (taken < n) {
+      for (unsigned i = 0; i < nt; i++) syms[i] = tapes[i].get();
+      uint32_t tid = delta->lookup(state, syms);
+      if (tid == TransitionTable::npos) break;
+      if (tid != last) {
+        if (run) log(last, run);
+        last = tid;
+        run = 0;
+      }
+
+      const TransitionTable::StepRecord *step =
+          delta->stepsOf(tid);
+      if (opt::skip && delta->isSweep(tid) && skippable(tid)) {
+        int64_t k = 0;
+        for (int64_t limit = 64; limit <= max_skip;
+             limit *= 8) {
+          k = limit;
+          for (unsigned i = 0; i < nt; i++)
+            if (step[i].shift)
+              k = tapes[i].runLength(syms[i], step[i].shift, k);
+          if (k < limit) break;
+        }
+        k = std::min<uint64_t>(k, n - taken);
+        if (k > 1) {
+          for (unsigned i = 0; i < nt; i++)
+            if (step[i].shift)
+              tapes[i].fill(step[i].sym, step[i].shift, k);
+            else
+              tapes[i].stay(k);
+          nr_steps += k;
+          taken += k;
+          run += k;
+          if (until()) break;
+          continue;
+        }
+      }
+
+      for (unsigned i = 0; i < nt; i++)
+        tapes[i].setAndShift(step[i].sym, step[i].shift);
+      state = delta->nxtStateOf(tid);
+      nr_steps++;
+      taken++;
+      run++;
+      if (delta->stopsAt(state) || until()) break;
+    }
+    if (run) log(last, run);
+    return taken;
+  }
+
+  /* takes transition tid, which must be the one for the
+   * current state and symbols */
+  void applyStep(uint32_t tid) {
+    const TransitionTable::StepRecord *step =
+        delta->stepsOf(tid);
+    for (unsigned i = 0; i < tapes.size(); i++)
+      tapes[i].setAndShift(step[i].sym, step[i].shift);
+    state = delta->nxtStateOf(tid);
+    nr_steps++;
+  }
+
+  /* takes back the last step, which took transition tid. The
+   * transition tells the former state and the symbols it
+   * overwrote, so nothing else has to be recorded */
+  void undoStep(uint32_t tid) {
+    const TransitionTable::StepRecord *step =
+        delta->stepsOf(tid);
+    const TransitionInfo &info = delta->at(tid);
+    for (unsigned i = 0; i < tapes.size(); i++) {
+      TapeT &t = tapes[i];
+      t.setAndShift(t.get(), -step[i].shift);
+      t.setAndShift(info.curSymbols[i], 0);
+    }
+    state = info.curState;
+    nr_steps--;
+  }
+
+  /* writes the configuration to a snapshot file, false if it
+   * cannot be written */
+  bool save(const std::string &path) const {
+#if HAVE_MMAP
+    SnapshotFile::Header h;
+    memcpy(h.magic, SnapshotFile::magic, sizeof(h.magic));
+    h.program = prog->fingerprint();
+    h.steps = nr_steps;
+    h.state = state;
+    h.nTapes = tapes.size();
+
+    Configuration c;
+    get_config(c);
+    std::vector<SnapshotFile::TapeHeader> th(tapes.size());
+    std::vector<std::pair<const char *, size_t>> chunks = {
+        {(const char *)&h, sizeof(h)}};
+    for (unsigned i = 0; i < tapes.size(); i++) {
+      th[i].head = c.heads[i];
+      th[i].start = c.starts[i];
+      th[i].length = c.contents[i].size();
+      chunks.emplace_back((const char *)&th[i], sizeof(th[i]));
+      chunks.emplace_back(
+          c.contents[i].data(), c.contents[i].size());
+    }
+    return SnapshotFile::write(path, chunks);
+#else
+    return false;
+#endif
+  }
+
+  /* continues from a snapshot of this program instead of an
+   * input, false if the file is not one */
+  bool restore(const std::string &path) {
+#if HAVE_MMAP
+    SnapshotFile f(path);
+    const char *p = f.data(), *end = p + f.size();
+    SnapshotFile::Header h;
+    if (f.size() < sizeof(h)) return false;
+    memcpy(&h, p, sizeof(h));
+    p += sizeof(h);
+    if (memcmp(h.magic, SnapshotFile::magic, sizeof(h.magic)) ||
+        h.program != prog->fingerprint() ||
+        h.nTapes != tapes.size() ||
+        h.state >= prog->stateStrings.size())
+      return false;
+
+    reset();
+    for (unsigned i = 0; i < tapes.size(); i++) {
+      SnapshotFile::TapeHeader th;
+      if (size_t(end - p) < sizeof(th)) return false;
+      memcpy(&th, p, sizeof(th));
+      p += sizeof(th);
+      if (th.length < 0 || end - p < th.length) return false;
+      tapes[i].restore(th.start, p, th.length, th.head);
+      p += th.length;
+    }
+    state = h.state;
+    nr_steps = h.steps;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  const char *readCurSymbols() {
+    for (unsigned i = 0; i < tapes.size(); i++)
+      symbuf[i] = tapes[i].get();
+    return symbuf.data();
+  }
+
+  bool runOneStep() {
+    uint32_t tid = delta->lookup(state, readCurSymbols());
+    if (tid == TransitionTable::npos) {
+      // cannot proceed since no guidelines about current
+      // state and tape symbols
+      return true;
+    }
+
+    /* set new state */
+    const TransitionTable::StepRecord *step =
+        delta->stepsOf(tid);
+    for (unsigned i = 0; i < tapes.size(); i++)
+      tapes[i].setAndShift(step[i].sym, step[i].shift);
+    state = delta->nxtStateOf(tid);
+    return false;
+  }
+
+  /* a tape that is not buffered can report an endless blank
+   * run, skip it in bounded chunks */
+  static constexpr int64_t max_skip = int64_t(1) << 30;
+
+  /* the step loop specialized on the number of tapes N, so
+   * that reading, writing and moving is fully unrolled. N = 0
+   * is the generic version for any number of tapes. P counts
+   * every step into the profile */
+  template <unsigned N, bool P = false>
+  void runLoop() {
+    const unsigned n = N ? N : tapes.size();
+    TapeT *t = tapes.data();
+    char fixed[N ? N : 1];
+    char *syms = N ? fixed : symbuf.data();
+    uint64_t *hits = P ? profile->hits.data() : nullptr;
+    uint32_t countdown = Profiler::sample_period;
+
+    while (true) {
+      for (unsigned i = 0; i < n; i++) syms[i] = t[i].get();
+      uint32_t tid = delta->lookup<N>(state, syms);
+      if (tid == TransitionTable::npos) break;
+      if (nr_steps >= nextCheck && overBudget()) break;
+      if (P && --countdown == 0) {
+        countdown = Profiler::sample_period;
+        profile->sample(state, nr_steps, tapeCells());
+      }
+
+      const TransitionTable::StepRecord *step =
+          delta->stepsOf(tid);
+      if (opt::skip && delta->isSweep(tid)) {
+        /* jump over the whole run at once, the scan limit
+         * grows geometrically so that a long run on one tape
+         * costs nothing if another tape's run is short */
+        int64_t k = 0;
+        for (int64_t limit = 64; limit <= max_skip;
+             limit *= 8) {
+          k = limit;
+          for (unsigned i = 0; i < n; i++)
+            if (step[i].shift)
+              k = t[i].runLength(syms[i], step[i].shift, k);
+          if (k < limit) break;
+        }
+        /* nextCheck <= maxSteps, a skip may pass the next
+         * check but not the step limit */
+        k = std::min<uint64_t>(k, maxSteps - nr_steps);
+        if (k > 1) {
+          for (unsigned i = 0; i < n; i++)
+            if (step[i].shift)
+              t[i].fill(step[i].sym, step[i].shift, k);
+            else
+              t[i].stay(k);
+          nr_steps += k;
+          if (P) hits[tid] += k;
+          continue;
+        }
+      }
+
+      for (unsigned i = 0; i < n; i++)
+        t[i].setAndShift(step[i].sym, step[i].shift);
+      state = delta->nxtStateOf(tid);
+      nr_steps++;
+      if (P) hits[tid]++;
+      if (delta->stopsAt(state)) break;
+    }
+  }
+
+  /* false if the JIT does not support this program or host,
+   * the caller then falls back to the interpreter */
+  bool runJit() {
+#if HAVE_JIT
+    if (!jitTried) {
+      jitTried = true;
+      jit = JitCode::compile(*prog);
+    }
+    if (!jit) return false;
+
+    JitCode::Context ctx;
+    while (true) {
+      /* a restored run may start past the step limit, so the
+       * budget is checked before the code is entered */
+      if (nr_steps >= nextCheck &&
+          (!canStep() || overBudget()))
+        break;
+      for (unsigned i = 0; i < tapes.size(); i++) {
+        Tape &t = tapes[i];
+        t.ensure(t.get_index());
+        ctx.head[i] = t.data() + t.get_index();
+        ctx.lo[i] = t.data() + t.first();
+        ctx.hi[i] = t.data() + t.last();
+        ctx.min[i] = ctx.max[i] = ctx.head[i];
+      }
+      /* the code returns at the next budget check */
+      uint64_t budget = nextCheck - nr_steps;
+      ctx.budget = budget;
+      ctx.state = state;
+
+      JitCode::Exit reason = jit->enter(&ctx);
+
+      nr_steps += budget - ctx.budget;
+      state = ctx.state;
+      for (unsigned i = 0; i < tapes.size(); i++) {
+        Tape &t = tapes[i];
+        t.seek(ctx.head[i] - t.data());
+        /* a head may stop one cell outside its window */
+        t.touched(std::max(ctx.min[i] - t.data(), t.first()),
+            std::min(ctx.max[i] - t.data() + 1, t.last()));
+      }
+      if (reason == JitCode::STOP) break;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /* macro machine for single-tape programs, false if the
+   * program has more tapes */
+  bool runMacro() {
+    if (tapes.size() != 1) return false;
+    if (!macro)
+      macro = std::make_shared<MacroCache>(
+          *delta, opt::macro_block);
+
+    MacroCache &mc = *macro;
+    const int64_t B = mc.B;
+    Tape &t = tapes[0];
+    uint64_t lookups = 0, windowHits = mc.hits;
+    while (true) {
+      if (nr_steps >= nextCheck &&
+          (!canStep() || overBudget()))
+        return true;
+      /* a block may take up to max_block_steps, step the
+       * last ones exactly */
+      if (maxSteps - nr_steps <= MacroCache::max_block_steps)
+        break;
+
+      int64_t pos = t.get_index();
+      int64_t base =
+          (pos >= 0 ? pos / B : (pos - B + 1) / B) * B;
+      t.ensure(base);
+      t.ensure(base + B - 1);
+      char *block = t.data() + base;
+
+      MacroCache::Key key;
+      key.state = state;
+      key.pos = pos - base;
+      bool packed = mc.pack(block, key.contents);
+      const MacroCache::Result *hit =
+          packed ? mc.find(key) : nullptr;
+
+      MacroCache::Result r;
+      MacroCache::Outcome o = MacroCache::EXIT;
+      if (hit) {
+        r = *hit;
+        mc.unpack(r.contents, block);
+      } else {
+        o = mc.simulate(block, state, key.pos, r);
+        if (o == MacroCache::EXIT && packed &&
+            mc.pack(block, r.contents))
+          mc.insert(key, r);
+      }
+
+      t.touched(base, base + B);
+      t.seek(base + r.pos);
+      state = r.state;
+      nr_steps += r.steps;
+      if (o == MacroCache::STOP) return true;
+      if (o == MacroCache::LOOP) break;
+
+      /* fall back to plain stepping if blocks rarely repeat */
+      if (++lookups % (1 << 16) == 0) {
+        if (mc.hits - windowHits < (1 << 16) / 4) break;
+        windowHits = mc.hits;
+      }
+    }
+
+    runLoop<1>();
+    return true;
+  }
+
+  /* engines that write the cells of a flat Tape directly,
+   * false if none of them ran */
+  bool runRaw() {
+    if constexpr (std::is_same<TapeT, Tape>::value)
+      return (opt::macro && runMacro()) ||
+             (opt::jit && runJit());
+    return false;
+  }
+
+  /* plain stepping with the divergence detector, prints
+   * every step in verbose mode */
+  void runDetect() {
+    DivergenceDetector<TapeT> det(tapes, prog->blank);
+    if (opt::verbose) printOneStep();
+    while (true) {
+      uint32_t tid = delta->lookup(state, readCurSymbols());
+      if (tid == TransitionTable::npos) break;
+      if (nr_steps >= nextCheck && overBudget()) break;
+
+      const TransitionTable::StepRecord *step =
+          delta->stepsOf(tid);
+      for (unsigned i = 0; i < tapes.size(); i++) {
+        det.write(i, tapes[i], step[i].sym);
+        tapes[i].setAndShift(step[i].sym, step[i].shift);
+      }
+      state = delta->nxtStateOf(tid);
+      nr_steps++;
+      if (opt::verbose) printOneStep();
+      if (delta->stopsAt(state)) break;
+
+      int shift = tapes.size() ? step[0].shift : 0;
+      if (det.diverges(tapes, state, shift)) {
+        stopped = DIVERGES;
+        break;
+      }
+    }
+  }
+
+  /* plain stepping that records every step */
+  void runTrace() {
+    Configuration c;
+    while (true) {
+      if (trace->due()) {
+        get_config(c);
+        trace->keyframe(c);
+      }
+      uint32_t tid = delta->lookup(state, readCurSymbols());
+      if (tid == TransitionTable::npos) break;
+      if (nr_steps >= nextCheck && overBudget()) break;
+
+      applyStep(tid);
+      trace->step(tid);
+      if (delta->stopsAt(state)) break;
+    }
+  }
+
+  /* dispatch once on the number of tapes */
+  template <bool P>
+  void runLoops() {
+    switch (tapes.size()) {
+    case 1: runLoop<1, P>(); break;
+    case 2: runLoop<2, P>(); break;
+    case 3: runLoop<3, P>(); break;
+    case 4: runLoop<4, P>(); break;
+    default: runLoop<0, P>(); break;
+    }
+  }
+
+  std::string run() {
+    startBudgets();
+    if (trace) {
+      runTrace();
+    } else if (opt::detect) {
+      runDetect();
+    } else if (opt::verbose) {
+      printOneStep();
+      while (true) {
+        if (nr_steps >= nextCheck && canStep() && overBudget())
+          break;
+        if (runOneStep()) break;
+        nr_steps++;
+        printOneStep();
+        if (delta->stopsAt(state)) break;
+      }
+    } else if (profile) {
+      /* the raw engines take many steps at once */
+      profile->restart();
+      runLoops<true>();
+      profile->sample(state, nr_steps, tapeCells());
+    } else if (!runRaw()) {
+      runLoops<false>();
+    }
+
+    if (tapes.empty()) return "";
+    return tapes.at(0).get_contents();
+  }
+
+  void printOneStep() {
+    /* Step   : 0
+     * Index0 : 0 1 2 3 4 5 6
+     * Tape0  : 1 0 0 1 0 0 1
+     * Head0  : ^
+     * Index1 : 0
+     * Tape1  : _
+     * Head1  : ^
+     * State  : 0
+     * ---------------------------------------------
+     **/
+    std::cout << "Step   : " << nr_steps << "\n";
+
+    for (unsigned i = 0; i < tapes.size(); i++) {
+      int64_t cbegin = tapes[i].cbegin();
+      int64_t cend = tapes[i].cend();
+      int64_t index = tapes[i].get_index();
+      if (cbegin >= cend) {
+        cbegin = index;
+        cend = index + 1;
+      } else if (index >= cend) {
+        cend = index + 1;
+      } else if (index < cbegin) {
+        cbegin = index;
+      }
+
+      std::cout << "Index" << i << " :";
+      for (int64_t j = cbegin; j < cend; j++)
+        if (j >= 0)
+          std::cout << " " << j;
+        else
+          std::cout << " " << -j;
+      std::cout << "\n";
+
+      std::cout << "Tape" << i << "  :";
+      for (int64_t j = cbegin; j < cend; j++) {
+        unsigned n = 1;
+        if (j != cbegin) {
+          if (j < 1)
+            n = std::to_string(j - 1).size() - 1;
+          else
+            n = std::to_string(j - 1).size();
+        }
+        for (unsigned i = 0; i < n; i++) std::cout << " ";
+        std::cout << tapes[i].get(j);
+      }
+      std::cout << "\n";
+
+      std::cout << "Head" << i << "  :";
+      for (int64_t j = cbegin; j < index; j++) {
+        unsigned n = (j >= 0)
+                         ? std::to_string(j).size()
+                         : (std::to_string(j).size() - 1);
+        for (unsigned k = 0; k < n + 1; k++)
+          std::cout << " ";
+      }
+      std::cout << " ^\n";
+    }
+
+    std::cout << "State  : " << prog->stateStrings.at(state)
+              << "\n";
+    /* clang-format off */
+    std::cout << "---------------------------------------------\n";
+    /* clang-format on */
+  }
+
+  void dump() {
+    std::clog << "#Q = {";
+    for (const std::string &s : prog->stateStrings)
+      std::clog << s << ", ";
+    std::clog << "}\n";
+
+    std::clog << "#q0 = " << prog->stateStrings.at(state) << "\n";
+    std::clog << "#B = " << prog->blank << "\n";
+
+    std::clog << "#F = {";
+    for (unsigned s = 0; s < prog->stateStrings.size(); s++)
+      if (delta->isFinal(s))
+        std::clog << prog->stateStrings.at(s) << ", ";
+    std::clog << "}\n";
+
+    std::clog << "#N = " << tapes.size() << "\n";
+
+    for (const TransitionInfo &info :
+        delta->get_transitions()) {
+      std::clog << prog->stateStrings[info.curState] << " ";
+      std::clog << info.curSymbols << " ";
+
+      for (std::pair<char, char> chs : info.nxtStep)
+        std::clog << chs.first;
+      std::clog << " ";
+
+      for (std::pair<char, char> chs : info.nxtStep)
+        std::clog << chs.second;
+      std::clog << " ";
+
+      std::clog << prog->stateStrings[info.nxtState] << "\n";
+    }
+  }
+};
+
+using TuringMachine = BasicTuringMachine<Tape>;
+
+template <class... Args>
+std::string formatv(const char *fmt, Args &&... args) {
+  std::vector<std::string> args_strs = {
+      static_cast<const std::ostringstream &>(
+          std::ostringstream{}
+          << std::forward<Args>((Args)args))
+          .str()...};
+
+  std::string ret;
+  unsigned counter = 0;
+  for (const char *p = fmt; *p; p++) {
+    if (*p == '%') {
+      p++;
+      if (*p == 's')
+        ret += args_strs.at(counter++);
+      else if (*p != 0)
+        ret += *p;
+      else
+        break;
+    } else {
+      ret += *p;
+    }
+  }
+  return ret;
+}
+
+#if 0
+template <class T>
+class error_or : public std::optional<T> {
+  std::ostringstream oss;
+
+public:
+  using std::optional<T>::optional<T>;
+  using std::optional<T>::operator=;
+  using std::optional<T>::operator bool;
+
+  template <class U>
+  friend error_or &operator<<(error_or &os, U &&msg) {
+    oss << std::forward<U>(msg);
+    return *this;
+  }
+
+  const std::string &get_error() const { return oss.str(); }
+  std::string &&get_error() { return oss.str(); }
+
+  bool has_error() {
+    return !bool(static_cast<std::optional<T> &>(*this));
+  }
+};
+#endif
+
+/* character classes of the .tm syntax, looked up in a table
+ * per character */
+enum : uint8_t {
+  C_BLANK = 1,  // between tokens
+  C_STATE = 2,  // state names
+  C_ACTION = 4, // printable but not a separator
+  C_TAPE = 8,   // tape symbols, actions without *
+  C_INPUT = 16, // input symbols, tape symbols without _
+};
+
+struct CharClasses {
+  uint8_t of[256] = {};
+
+  constexpr CharClasses() {
+    for (int ch = 0; ch < 256; ch++) {
+      uint8_t c = 0;
+      if (ch == ' ' || ch == '\t') c |= C_BLANK;
+      if ((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') ||
+          (ch >= 'A' && ch <= 'Z') || ch == '_')
+        c |= C_STATE;
+      if (ch > ' ' && ch < 127 && ch != ',' && ch != ';' &&
+          ch != '{' && ch != '}') {
+        c |= C_ACTION;
+        if (ch != '*') c |= C_TAPE;
+        if (ch != '*' && ch != '_') c |= C_INPUT;
+      }
+      of[ch] = c;
+    }
+  }
+};
+static constexpr CharClasses charClasses;
+
+/* the text of a .tm file in one buffer that the parser walks
+ * with a cursor, mapped from the file when it can be. Tokens
+ * are views into the buffer, and line and column are only
+ * counted when an error is reported */
+class TextCursor {
+  std::string copy; // of a stream or an unmappable file
+#if HAVE_MMAP
+  void *mapped = MAP_FAILED;
+  size_t mappedLen = 0;
+#endif
+  const char *text = "", *p = text, *end = text;
+
+public:
+  const bool quiet = false;
+  bool failed = false;
+
+private:
+  void read(std::istream &is) {
+    char buf[1 << 16];
+    while (is.read(buf, sizeof(buf)) || is.gcount())
+      copy.append(buf, is.gcount());
+    text = p = copy.data();
+    end = text + copy.size();
+  }
+
+public:
+  TextCursor(std::istream &is) { read(is); }
+
+  TextCursor(const char *path) {
+#if HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+      off_t size = lseek(fd, 0, SEEK_END);
+      if (size > 0)
+        mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE,
+            fd, 0);
+      close(fd);
+      if (mapped != MAP_FAILED) {
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        mappedLen = size;
+        text = p = (const char *)mapped;
+        end = text + size;
+        return;
+      }
+    }
+#endif
+    std::ifstream ifs(path, std::ios::binary);
+    read(ifs);
+  }
+
+  /* the part [b, e) of whole, positions are still reported
+   * in whole. Errors on a quiet cursor are not reported, they
+   * only mark it failed */
+  TextCursor(const TextCursor &whole, const char *b,
+      const char *e, bool quiet)
+      : text(whole.text), p(b), end(e), quiet(quiet) {}
+
+  TextCursor(const TextCursor &) = delete;
+  ~TextCursor() {
+#if HAVE_MMAP
+    if (mapped != MAP_FAILED) munmap(mapped, mappedLen);
+#endif
+  }
+
+  bool endl() const {
+    return p == end || *p == '\n' || *p == ';';
+  }
+
+  bool good() const { return p < end; }
+
+  /* a comment is read as the ; that starts it */
+  char get() {
+    if (p == end) return EOF;
+    char ch = *p++;
+    if (ch == ';') {
+      p = (const char *)memchr(p, '\n', end - p);
+      p = p ? p + 1 : end;
+    }
+    return ch;
+  }
+
+  char peek() const { return p < end ? *p : EOF; }
+
+  void ignore() { get(); }
+
+  /* the characters of the classes in mask from here on */
+  std::string_view scan(uint8_t mask) {
+    const char *b = p;
+    while (p < end && (charClasses.of[(uint8_t)*p] & mask)) p++;
+    return std::string_view(b, p - b);
+  }
+
+  const char *pos() const { return p; }
+  void seek(const char *at) { p = at; }
+
+  /* the start of the line after the one of at */
+  const char *lineAfter(const char *at) const {
+    const char *nl = (const char *)memchr(at, '\n', end - at);
+    return nl ? nl + 1 : end;
+  }
+
+  /* the start of the next line that is a directive, or the
+   * end of the text */
+  const char *nextDirective() const {
+    for (const char *q = lineAfter(p); q < end;
+         q = lineAfter(q)) {
+      const char *r = q;
+      while (r < end && (charClasses.of[(uint8_t)*r] & C_BLANK))
+        r++;
+      if (r < end && *r == '#') return q;
+    }
+    return end;
+  }
+
+  /* position of at, the start of the text for nullptr */
+  unsigned lineOf(const char *at) const {
+    return std::count(text, at ? at : text, '\n');
+  }
+  unsigned columnOf(const char *at) const {
+    if (!at) return 0;
+    const char *b = at;
+    while (b > text && b[-1] != '\n') b--;
+    return at - b;
+  }
+  /* the line of at without its comment */
+  std::string_view lineAt(const char *at) const {
+    const char *b = at ? at : text;
+    b -= columnOf(b);
+    const char *e = b;
+    while (e < end && *e != '\n' && *e != ';') e++;
+    return std::string_view(b, e - b);
+  }
+
+  unsigned get_lineno() const { return lineOf(p); }
+  unsigned get_column() const { return columnOf(p); }
+};
+
+class TMParser {
+  bool found_error = false;
+  /* tokens are views into the text being parsed, errors are
+   * reported at their position */
+  using StringToken = std::string_view;
+  /* filled from #Q, only read while transitions are checked
+   * on several threads */
+  std::unordered_map<StringToken, unsigned> stateIdMap;
+
+  // #Q = {0,cp,cmp,mh,accept}
+  std::vector<StringToken> states;
+  // #S = {0,1}
+  std::vector<StringToken> inputSymbolSet; // #S
+  // #G = {0,1,_,t,r,u,e,f,a,l,s}
+  std::vector<StringToken> tapeSymbolSet; // #G
+  // #q0 = 0
+  StringToken initState;
+  // #B = _
+  StringToken blankSymbol; // #B
+  // #F = {halt_accept}
+  std::vector<StringToken> finalStates; // #F
+  // #N = 2
+  unsigned nTapes = -1u; // #N
+  // cmp 01 __ rl reject
+  // 0 __ __ ** accept
+
+  struct DeltaEntry {
+    StringToken curState;
+    StringToken curSymbols;
+    StringToken nxtSymbols;
+    StringToken actions;
+    StringToken nxtState;
+    // resolved by checkStates(), -1u if not in #Q
+    unsigned cur = -1u, nxt = -1u;
+    bool symbolsOk = true;
+  };
+  std::vector<DeltaEntry> delta;
+
+  // #S and #B, indexed by char
+  bool validInput[256] = {};
+  // #G and #B, indexed by char
+  bool validTape[256] = {};
+
+  void report_error_here(
+      const std::string &msg, TextCursor &wis) {
+    report_error(StringToken(wis.pos(), 0), msg, wis);
+  }
+
+  void report_error(const StringToken &tok,
+      const std::string &msg, TextCursor &wis) {
+    if (wis.quiet) {
+      wis.failed = true;
+      return;
+    }
+    found_error = true;
+    if (!opt::verbose) {
+      std::cerr << "syntax error\n";
+      exit(1);
+    }
+
+    unsigned column = wis.columnOf(tok.data());
+    std::cerr << "error at line " << (wis.lineOf(tok.data()) + 1)
+              << " column " << (column + 1) << ": " << msg
+              << "\n";
+    std::cerr << wis.lineAt(tok.data()) << '\n';
+    for (unsigned i = 0; i < column; i++) std::cerr << " ";
+    for (unsigned i = 0;
+         i < std::max<unsigned>(tok.size(), 1u); i++)
+      std::cerr << "^";
+    std::cerr << '\n';
+  }
+
+private:
+  bool erase_blank(TextCursor &wis) {
+    wis.scan(C_BLANK);
+    return wis.good();
+  }
+
+  bool erase_blank_until(TextCursor &wis, char ch) {
+    erase_blank(wis);
+    if (wis.get() != ch) {
+      report_error_here(
+          formatv("expected `%s' here", ch), wis);
+      return false;
+    }
+    return wis.good();
+  }
+
+  StringToken parseState(TextCursor &wis) {
+    StringToken state = wis.scan(C_STATE);
+
+    if (state.size() == 0)
+      report_error_here("expected state here", wis);
+    return state;
+  }
+
+  StringToken parseActions(TextCursor &wis) {
+    StringToken symbol = wis.scan(C_ACTION);
+
+    if (symbol.size() == 0)
+      report_error_here("expected input symbol here", wis);
+    return symbol;
+  }
+
+  StringToken parseInputSymbol(TextCursor &wis) {
+    StringToken symbol = wis.scan(C_INPUT);
+
+    if (symbol.size() == 0)
+      report_error_here("expected input symbol here", wis);
+    return symbol;
+  }
+
+  StringToken parseTapeSymbol(TextCursor &wis) {
+    StringToken symbol = wis.scan(C_TAPE);
+
+    if (symbol.size() == 0)
+      report_error_here("expected tape symbol here", wis);
+    return symbol;
+  }
+
+  std::vector<StringToken> parseStringArray(
+      TextCursor &wis,
+      StringToken (TMParser::*extractor)(
+          TextCursor &)) {
+    erase_blank(wis);
+    pdbg("[parseStringArray] after erase blank, '%s'\n",
+        wis.peek());
+    if (wis.get() != '{')
+      report_error_here(
+          "expected '{' here, parse it anyway", wis);
+
+    std::vector<StringToken> retSet;
+    while (!wis.endl()) {
+      erase_blank(wis);
+      StringToken s = (this->*extractor)(wis);
+      pdbg(
+          "[parseStringArray] extract '%s'-'%s' "
+          "[%s:%s:%s]\n",
+          std::string(s), wis.peek(), wis.lineOf(s.data()),
+          wis.columnOf(s.data()), s.size());
+      if (s.size() > 0) retSet.push_back(s);
+
+      erase_blank(wis);
+      if (wis.endl()) break;
+
+      char ch = wis.get();
+      if (ch == '}')
+        break;
+      else if (ch == ',')
+        continue;
+      else {
+        report_error(StringToken(wis.pos() - 1, 1),
+            "expected '}' or ',' here", wis);
+      }
+    }
+
+    erase_blank(wis);
+    pdbg("[parseStringArray] final blank '%s'\n",
+        wis.peek());
+    return retSet;
+  }
+
+  std::vector<StringToken> parseStateArray(
+      TextCursor &wis) {
+    return parseStringArray(wis, &TMParser::parseState);
+  }
+
+  std::vector<StringToken> parseInputSymbolArray(
+      TextCursor &wis) {
+    return parseStringArray(
+        wis, &TMParser::parseInputSymbol);
+  }
+
+  std::vector<StringToken> parseTapeSymbolArray(
+      TextCursor &wis) {
+    return parseStringArray(
+        wis, &TMParser::parseTapeSymbol);
+  }
+
+  DeltaEntry parseDelta(TextCursor &wis) {
+    pdbg("[mainloop.action], next '%s'\n", wis.peek());
+    DeltaEntry e;
+    e.curState = parseState(wis);
+    pdbg("[mainloop.action.State] '%s'\n",
+        std::string(e.curState));
+    erase_blank(wis);
+    e.curSymbols = parseTapeSymbol(wis);
+    pdbg("[mainloop.action.CurSym] '%s'\n",
+        std::string(e.curSymbols));
+    erase_blank(wis);
+    e.nxtSymbols = parseTapeSymbol(wis);
+    pdbg("[mainloop.action.NxtSym] '%s'\n",
+        std::string(e.nxtSymbols));
+    erase_blank(wis);
+    e.actions = parseActions(wis);
+    pdbg("[mainloop.action.Actions] '%s'\n",
+        std::string(e.actions));
+    erase_blank(wis);
+    e.nxtState = parseState(wis);
+    while (!wis.endl()) wis.ignore();
+    wis.ignore();
+    return e;
+  }
+
+  /* tape counts and actions of one transition, in file order
+   * since #N is deduced as it goes */
+  void checkDelta(const DeltaEntry &e, unsigned preseted_nTapes,
+      TextCursor &wis) {
+    for (const StringToken *stp :
+        {&e.curSymbols, &e.nxtSymbols, &e.actions}) {
+      unsigned old = nTapes;
+      nTapes = std::min<unsigned>(stp->size(), nTapes);
+      if (preseted_nTapes != -1u &&
+          preseted_nTapes != stp->size()) {
+        report_error(*stp,
+            formatv(
+                "#N=%s, size %s here is inconsistent, "
+                "we adjust #N to %s as minimum value",
+                preseted_nTapes, stp->size(), nTapes),
+            wis);
+      } else if (old != -1u && old != stp->size()) {
+        report_error(*stp,
+            formatv(
+                "deduced #N=%s, size %s here is "
+                "inconsistent, "
+                "we adjust #N to %s as minimum value",
+                old, stp->size(), nTapes),
+            wis);
+      }
+    }
+
+    for (unsigned i = 0; i < e.actions.size(); i++) {
+      char a = e.actions[i];
+      if (a != 'l' && a != 'r' && a != '*')
+        report_error(StringToken(e.actions.data() + i, 1),
+            "expected l, r, * here", wis);
+    }
+  }
+
+  /* the transitions of wis, checked as they are parsed if
+   * check is set */
+  void parseDeltaLines(TextCursor &wis,
+      std::vector<DeltaEntry> &out, unsigned preseted_nTapes,
+      bool check) {
+    while (wis.good()) {
+      erase_blank(wis);
+      if (wis.endl()) {
+        wis.get();
+        continue;
+      }
+      out.push_back(parseDelta(wis));
+      if (check) checkDelta(out.back(), preseted_nTapes, wis);
+    }
+  }
+
+  /* f(k) for every k < n, each on its own thread */
+  template <class F>
+  static void inParallel(unsigned n, const F &f) {
+    std::vector<std::thread> threads;
+    for (unsigned k = 1; k < n; k++)
+      threads.emplace_back([&f, k]() { f(k); });
+    f(0);
+    for (std::thread &t : threads) t.join();
+  }
+
+  /* threads for n units of work, at least grain each */
+  unsigned threadsFor(size_t n, size_t grain) const {
+    size_t cores = threads ? threads
+                           : std::thread::hardware_concurrency();
+    return std::max<size_t>(1, std::min(cores, n / grain));
+  }
+
+  static constexpr size_t min_chunk = 1 << 20; // bytes
+
+  /* the transitions from here to the next directive. A long
+   * run is cut into line-aligned chunks that are parsed on
+   * several threads, then checked in order. A chunk with an
+   * error is parsed again on this thread, so that errors are
+   * reported as a sequential parse reports them */
+  void parseDeltaRun(TextCursor &wis, unsigned preseted_nTapes) {
+    const char *b = wis.pos(), *e = wis.nextDirective();
+    const unsigned n = threadsFor(e - b, min_chunk);
+    wis.seek(e);
+    if (n == 1) {
+      TextCursor part(wis, b, e, false);
+      parseDeltaLines(part, delta, preseted_nTapes, true);
+      return;
+    }
+
+    std::vector<const char *> cuts = {b};
+    for (unsigned k = 1; k < n; k++)
+      cuts.push_back(std::max(cuts.back(),
+          wis.lineAfter(b + (e - b) / n * k)));
+    cuts.push_back(e);
+
+    std::vector<std::vector<DeltaEntry>> parts(n);
+    std::vector<char> failed(n);
+    inParallel(n, [&](unsigned k) {
+      TextCursor part(wis, cuts[k], cuts[k + 1], true);
+      parseDeltaLines(part, parts[k], preseted_nTapes, false);
+      failed[k] = part.failed;
+    });
+
+    size_t total = delta.size();
+    for (const auto &part : parts) total += part.size();
+    delta.reserve(total);
+    for (unsigned k = 0; k < n; k++) {
+      if (failed[k]) {
+        TextCursor part(wis, cuts[k], cuts[k + 1], false);
+        parseDeltaLines(part, delta, preseted_nTapes, true);
+        continue;
+      }
+      for (DeltaEntry &entry : parts[k]) {
+        checkDelta(entry, preseted_nTapes, wis);
+        delta.push_back(entry);
+      }
+    }
+  }
+
+  /* resolves the states of every transition and checks its
+   * symbols against #G, on several threads */
+  void checkStates() {
+    for (const StringToken &s : tapeSymbolSet)
+      validTape[(unsigned char)s.at(0)] = true;
+    validTape[(unsigned char)blank()] = true;
+    auto find = [this](StringToken s) {
+      auto it = stateIdMap.find(s);
+      return it == stateIdMap.end() ? -1u : it->second;
+    };
+
+    const unsigned n = threadsFor(delta.size(), 1 << 16);
+    inParallel(n, [&](unsigned k) {
+      size_t from = delta.size() * k / n;
+      size_t to = delta.size() * (k + 1) / n;
+      for (size_t i = from; i < to; i++) {
+        DeltaEntry &e = delta[i];
+        e.cur = find(e.curState);
+        e.nxt = find(e.nxtState);
+        for (StringToken syms : {e.curSymbols, e.nxtSymbols})
+          for (char ch : syms)
+            e.symbolsOk &= validTape[(unsigned char)ch];
+      }
+    });
+  }
+
+  /* #B, or '\0' if there was none */
+  char blank() const {
+    return blankSymbol.empty() ? '\0' : blankSymbol[0];
+  }
+
+public:
+  /* threads for long runs of transitions, 0 for one per core */
+  unsigned threads = 0;
+
+  TMParser() {}
+
+  void dump() {
+    std::clog << "#Q = {";
+    for (const StringToken &s : states)
+      std::clog << std::string(s) << ", ";
+    std::clog << "}\n";
+
+    std::clog << "#S = {";
+    for (const StringToken &s : inputSymbolSet)
+      std::clog << std::string(s) << ", ";
+    std::clog << "}\n";
+
+    std::clog << "#G = {";
+    for (const StringToken &s : tapeSymbolSet)
+      std::clog << std::string(s) << ", ";
+    std::clog << "}\n";
+
+    std::clog << "#q0 = ";
+    std::clog << std::string(initState) << "\n";
+
+    std::clog << "#B = ";
+    std::clog << std::string(blankSymbol) << "\n";
+
+    std::clog << "#F = {";
+    for (const StringToken &s : finalStates)
+      std::clog << std::string(s) << ", ";
+    std::clog << "}\n";
+
+    std::clog << "#N = " << nTapes << "\n";
+
+    for (const DeltaEntry &e : delta) {
+      for (char ch : e.curState) std::clog << ch;
+      std::clog << " ";
+      for (char ch : e.curSymbols) std::clog << ch;
+      std::clog << " ";
+      for (char ch : e.nxtSymbols) std::clog << ch;
+      std::clog << " ";
+      for (char ch : e.actions) std::clog << ch;
+      std::clog << " ";
+      for (char ch : e.nxtState) std::clog << ch;
+      std::clog << " ";
+      std::clog << "\n";
+    }
+  }
+
+  bool validate_input(
+      const std::string &input, bool report = true) const {
+    /* ERROR
+     *
+     * Input: 100A1A001
+     * ==================== ERR ====================
+     * error: 'A' was not declared in the set of input
+     * symbols Input: 100A1A001
+     *  		 ^
+     * ==================== END ====================
+     *
+     * CORRECT
+     * Input: 1001001
+     * ==================== RUN ====================
+     * */
+    for (unsigned i = 0; i < input.size(); i++) {
+      char ch = input[i];
+      if (validInput[(unsigned char)ch]) continue;
+
+      if (!report) {
+        return false;
+      } else if (opt::verbose) {
+        /* clang-format off */
+        std::cerr << "Input: " << input << "\n";
+        std::cerr << "==================== ERR ====================\n";
+        std::cerr << "error: '" << ch
+                  << "' was not declared in the set of input symbols\n";
+        std::cerr << "Input: " << input << "\n";
+        for (unsigned j = 0; j < 7 + i; j++) std::cerr << " ";
+        std::cerr << "^\n";
+        std::cerr << "==================== END ====================\n";
+        /* clang-format on */
+      } else {
+        std::cerr << "illegal input\n";
+      }
+      return false;
+    }
+    return true;
+  }
+
+  std::shared_ptr<const Program> parseProgram(
+      std::istream &is) {
+    TextCursor wis(is);
+    return parse(wis);
+  }
+
+  /* the file is mapped rather than read when possible */
+  std::shared_ptr<const Program> parseFile(const char *path) {
+    TextCursor wis(path);
+    return parse(wis);
+  }
+
+  TuringMachine parseTMFile(std::istream &is) {
+    return TuringMachine(parseProgram(is));
+  }
+
+private:
+  std::shared_ptr<const Program> parse(TextCursor &wis) {
+    // a naive parser
+    unsigned preseted_nTapes = -1;
+    while (wis.good()) {
+      erase_blank(wis);
+      pdbg("[mainloop] erase initial blank, '%s'\n",
+          wis.peek());
+
+      if (wis.endl()) {
+        pdbg(
+            "[mainloop.endl] meet endl '%s'\n", wis.peek());
+        wis.get();
+      } else if (wis.peek() == '#') {
+        wis.ignore();
+        erase_blank(wis);
+        pdbg("[mainloop.#] after erase blank '%s'\n",
+            wis.peek());
+        char ch = wis.get();
+        switch (ch) {
+        case 'Q':
+        case 'S':
+        case 'G':
+        case 'F': {
+          erase_blank_until(wis, '=');
+          pdbg("[mainloop.#|=] after erase blank '%s'\n",
+              wis.peek());
+          std::vector<StringToken> sv =
+              (ch == 'Q' || ch == 'F')
+                  ? parseStateArray(wis)
+                  : (ch == 'S' ? parseInputSymbolArray(wis)
+                               : parseTapeSymbolArray(wis));
+
+          if (ch == 'Q') {
+            states = std::move(sv);
+            unsigned counter = 0;
+            for (const StringToken &state : states)
+              stateIdMap[state] = counter++;
+          } else if (ch == 'F') {
+            finalStates = std::move(sv);
+          } else if (ch == 'S') {
+            for (const StringToken &symbol : sv) {
+              if (symbol.size() > 1) {
+                report_error(symbol,
+                    "expected only one character as symbol "
+                    "in #S",
+                    wis);
+              }
+            }
+            inputSymbolSet = std::move(sv);
+          } else if (ch == 'G') {
+            for (const StringToken &symbol : sv) {
+              if (symbol.size() > 1) {
+                report_error(symbol,
+                    "expected only one character as symbol "
+                    "in #G",
+                    wis);
+              }
+            }
+            tapeSymbolSet = std::move(sv);
+          }
+        } break;
+        case 'q':
+          if ((ch = wis.get()) != '0') {
+            report_error_here(
+                formatv("expected #q0 here, not #q%s", ch),
+                wis);
+          }
+          erase_blank_until(wis, '=');
+          erase_blank(wis);
+          pdbg("[mainloop.#q0] next '%s'\n", wis.peek());
+          initState = parseState(wis);
+          break;
+        case 'B':
+          erase_blank_until(wis, '=');
+          erase_blank(wis);
+          blankSymbol = parseState(wis);
+          if (blankSymbol.size() != 1)
+            report_error(blankSymbol,
+                "blank symbol size <> 1\n", wis);
+          if (blankSymbol.empty()) blankSymbol = "_";
+          break;
+        case 'N': {
+          erase_blank_until(wis, '=');
+          erase_blank(wis);
+          unsigned n = 0;
+          while (wis.good() && std::isdigit(ch = wis.get()))
+            n = (ch - '0') + n * 10;
+          if (nTapes != -1u) {
+            report_error_here(
+                formatv("#N has been deduced to be %s from "
+                        "delta function",
+                    nTapes),
+                wis);
+          }
+          nTapes = n;
+          preseted_nTapes = n;
+        } break;
+        default:
+          report_error(StringToken(wis.pos() - 1, 1),
+              formatv("unexpected #%s", ch), wis);
+          break;
+        }
+
+        while (!wis.endl()) wis.ignore();
+        wis.ignore();
+      } else {
+        parseDeltaRun(wis, preseted_nTapes);
+      }
+    }
+    /* check state */
+    for (const StringToken &s : finalStates) {
+      if (stateIdMap.find(s) == stateIdMap.end())
+        report_error(s,
+            formatv("cannot find state '%s' in #Q from #F",
+                std::string(s)),
+            wis);
+    }
+    checkStates();
+    for (const DeltaEntry &e : delta) {
+      if (e.cur == -1u)
+        report_error(e.curState,
+            formatv(
+                "cannot find state '%s' in #Q from actions",
+                std::string(e.curState)),
+            wis);
+      if (e.nxt == -1u)
+        report_error(e.nxtState,
+            formatv(
+                "cannot find state '%s' in #Q from actions",
+                std::string(e.nxtState)),
+            wis);
+    }
+
+    if (stateIdMap.find(initState) == stateIdMap.end())
+      report_error(initState,
+          formatv("cannot find state %s (=#q0) in #Q",
+              std::string(initState)),
+          wis);
+
+    if (nTapes == -1u) {
+      std::cerr << "invalid #N " << nTapes << "\n";
+      nTapes = 0u;
+    }
+
+    /* check symbols, checkStates() flagged the transitions
+     * to report */
+    for (const DeltaEntry &e : delta) {
+      if (e.symbolsOk) continue;
+      for (const StringToken *stp :
+          {&e.curSymbols, &e.nxtSymbols}) {
+        for (unsigned i = 0; i < stp->size(); i++) {
+          char ch = stp->at(i);
+          if (validTape[(unsigned char)ch]) continue;
+
+          report_error(StringToken(stp->data() + i, 1),
+              formatv("symbol %s not found in #G", ch),
+              wis);
+        }
+      }
+    }
+
+#ifdef DEBUG
+    this->dump();
+#endif
+
+    if (found_error) exit(1);
+
+    for (const StringToken &s : inputSymbolSet)
+      validInput[(unsigned char)s.at(0)] = true;
+    if (blankSymbol.size())
+      validInput[(unsigned char)blank()] = true;
+
+    /* construct Program */
+    auto prog = std::make_shared<Program>();
+    prog->nTapes = nTapes;
+    prog->blank = blank();
+    prog->initState = stateIdMap[initState];
+    for (const StringToken &s : inputSymbolSet)
+      prog->inputSymbols.push_back(s.at(0));
+    if (blankSymbol.size())
+      prog->inputSymbols.push_back(blank());
+
+    for (const StringToken &s : states)
+      prog->stateStrings.emplace_back(s);
+
+    /* compile delta */
+    std::vector<char> alphabet = {blank()};
+    for (const StringToken &s : tapeSymbolSet)
+      alphabet.push_back(s.at(0));
+    for (const StringToken &s : inputSymbolSet)
+      alphabet.push_back(s.at(0));
+    prog->delta.init(states.size(), nTapes, alphabet);
+
+    for (const StringToken &s : finalStates)
+      prog->delta.setFinal(stateIdMap[s]);
+
+    for (const DeltaEntry &e : delta) {
+      TransitionTable::TransitionInfo info;
+      for (unsigned i = 0; i < nTapes; i++)
+        info.nxtStep.emplace_back(
+            e.nxtSymbols[i], e.actions[i]);
+      info.nxtState = e.nxt;
+      prog->delta.add(e.cur,
+          std::string(e.curSymbols.substr(0, nTapes)),
+          std::move(info));
+    }
+    prog->delta.finalize();
+
+    /* the tokens do not outlive the text */
+    stateIdMap.clear();
+    states.clear();
+    inputSymbolSet.clear();
+    tapeSymbolSet.clear();
+    finalStates.clear();
+    delta.clear();
+    initState = blankSymbol = StringToken();
+    return prog;
+  }
+};
+
+/* ahead-of-time compilation: translates a Program into a
+ * standalone C++ translation unit. Every state becomes a
+ * label, every transition a case of a switch on the packed
+ * symbol tuple, so the runner carries no interpretation
+ * overhead at all. The runner takes the input as argument,
+ * or reads one input per line from stdin without one. */
+class CppEmitter {
+  const Program &prog;
+  std::ostream &os;
+
+  static std::string charLit(char ch) {
+    return formatv("(char)%s", int((unsigned char)ch));
+  }
+
+  /* the symbol tuple of up to 8 tapes packed into 64 bits */
+  uint64_t packKey(const std::string &syms) const {
+    uint64_t key = 0;
+    for (unsigned i = 0; i < prog.nTapes; i++)
+      key |= uint64_t((unsigned char)syms[i]) << (8 * i);
+    return key;
+  }
+
+  void emitPrelude() {
+    /* clang-format off */
+    os << R"(#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+/* cell i lives at buf[origin + i] */
+struct Tape {
+  char *buf = nullptr;
+  int64_t cap = 0, origin = 0;
+};
+
+/* make buffer offset p addressable, returns the new offset */
+static int64_t grow(Tape &t, int64_t p, char blank) {
+  int64_t left = t.origin, right = t.cap - t.origin;
+  int64_t i = p - t.origin;
+  int64_t nleft = left, nright = right;
+  if (i < -left) nleft = std::max<int64_t>(-i, 2 * left);
+  if (i >= right) nright = std::max<int64_t>(i + 1, 2 * right);
+  nleft = std::max<int64_t>(nleft, 64);
+  nright = std::max<int64_t>(nright, 64);
+
+  char *nbuf = (char *)malloc(nleft + nright);
+  memset(nbuf, blank, nleft + nright);
+  if (t.buf) memcpy(nbuf + (nleft - left), t.buf, t.cap);
+  free(t.buf);
+  t.buf = nbuf;
+  t.cap = nleft + nright;
+  t.origin = nleft;
+  return i + nleft;
+}
+
+/* blank the tape and make cells [0, n] addressable, returns
+ * the buffer offset of cell 0 */
+static int64_t reset(Tape &t, int64_t n, char blank) {
+  if (t.cap - t.origin <= n) grow(t, t.origin + n, blank);
+  memset(t.buf, blank, t.cap);
+  return t.origin;
+}
+)";
+    /* clang-format on */
+  }
+
+  void emitTransition(uint32_t tid) {
+    const TransitionTable &delta = prog.delta;
+    const TransitionTable::StepRecord *step =
+        delta.stepsOf(tid);
+    for (unsigned i = 0; i < prog.nTapes; i++) {
+      os << "      t" << i << ".buf[p" << i
+         << "] = " << charLit(step[i].sym) << ";\n";
+      if (step[i].shift < 0) {
+        os << "      if (--p" << i << " < 0) p" << i
+           << " = grow(t" << i << ", p" << i
+           << ", blank);\n";
+      } else if (step[i].shift > 0) {
+        os << "      if (++p" << i << " >= t" << i
+           << ".cap) p" << i << " = grow(t" << i << ", p"
+           << i << ", blank);\n";
+      }
+    }
+
+    unsigned nxt = delta.nxtStateOf(tid);
+    if (delta.stopsAt(nxt))
+      os << "      goto done;\n";
+    else
+      os << "      goto S" << nxt << ";\n";
+  }
+
+  void emitState(unsigned s,
+      const std::vector<uint32_t> &tids) {
+    const TransitionTable &delta = prog.delta;
+    os << "S" << s << ": /* " << prog.stateStrings[s]
+       << " */\n";
+    if (tids.empty()) {
+      os << "  goto done;\n";
+      return;
+    }
+
+    if (prog.nTapes <= 8) {
+      os << "  switch (";
+      for (unsigned i = 0; i < prog.nTapes; i++)
+        os << (i ? " |\n          " : "")
+           << "(uint64_t)(unsigned char)t" << i << ".buf[p"
+           << i << "] << " << 8 * i;
+      if (prog.nTapes == 0) os << "0";
+      os << ") {\n";
+      for (uint32_t tid : tids) {
+        const std::string &syms = delta.at(tid).curSymbols;
+        os << "    case " << packKey(syms) << "ull: /* "
+           << syms << " */\n";
+        emitTransition(tid);
+      }
+      os << "    default: goto done;\n";
+      os << "  }\n";
+      return;
+    }
+
+    for (uint32_t tid : tids) {
+      const std::string &syms = delta.at(tid).curSymbols;
+      os << "  if (";
+      for (unsigned i = 0; i < prog.nTapes; i++)
+        os << (i ? " &&\n      " : "") << "t" << i
+           << ".buf[p" << i << "] == " << charLit(syms[i]);
+      os << ") { /* " << syms << " */\n";
+      emitTransition(tid);
+      os << "  }\n";
+    }
+    os << "  goto done;\n";
+  }
+
+  void emitRun() {
+    const TransitionTable &delta = prog.delta;
+    std::vector<std::vector<uint32_t>> byState(
+        prog.stateStrings.size());
+    for (uint32_t tid = 0; tid < delta.size(); tid++)
+      byState[delta.at(tid).curState].push_back(tid);
+
+    os << "\nstatic const char blank = " << charLit(prog.blank)
+       << ";\n";
+    os << "static Tape t[" << std::max(prog.nTapes, 1u)
+       << "];\n\n";
+
+    os << "static std::string run(const std::string &input) "
+          "{\n";
+    for (unsigned i = 0; i < prog.nTapes; i++) {
+      os << "  Tape &t" << i << " = t[" << i << "];\n";
+      os << "  int64_t p" << i << " = reset(t" << i << ", "
+         << (i ? "0" : "input.size()") << ", blank);\n";
+    }
+    if (prog.nTapes)
+      os << "  memcpy(t0.buf + p0, input.data(), "
+            "input.size());\n";
+    os << "  goto S" << prog.initState << ";\n\n";
+
+    /* entering a final or halting state stops the machine,
+     * so only the initial state can be jumped to */
+    for (unsigned s = 0; s < byState.size(); s++)
+      if (!delta.stopsAt(s) || s == prog.initState)
+        emitState(s, byState[s]);
+
+    os << "done:\n";
+    if (prog.nTapes) {
+      os << "  int64_t l = 0, r = t0.cap;\n";
+      os << "  while (l < r && t0.buf[l] == blank) l++;\n";
+      os << "  while (l < r && t0.buf[r - 1] == blank) r--;\n";
+      os << "  return std::string(t0.buf + l, r - l);\n";
+    } else {
+      os << "  return \"\";\n";
+    }
+    os << "}\n";
+  }
+
+  void emitMain() {
+    os << "\nstatic bool valid(const std::string &input) {\n";
+    os << "  for (char ch : input) {\n";
+    os << "    switch (ch) {\n";
+    for (char ch : prog.inputSymbols)
+      os << "    case " << charLit(ch) << ":\n";
+    os << "      continue;\n";
+    os << "    }\n";
+    os << "    return false;\n";
+    os << "  }\n";
+    os << "  return true;\n";
+    os << "}\n";
+
+    /* clang-format off */
+    os << R"(
+int main(int argc, const char *argv[]) {
+  if (argc > 1) {
+    if (!valid(argv[1])) {
+      std::cerr << "illegal input\n";
+      return 1;
+    }
+    std::cout << run(argv[1]) << "\n";
+    return 0;
+  }
+
+  std::ios::sync_with_stdio(false);
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (line.size() && line.back() == '\r') line.pop_back();
+    std::cout << (valid(line) ? run(line) : "illegal input")
+              << "\n";
+  }
+  return 0;
+}
+)";
+    /* clang-format on */
+  }
+
+public:
+  CppEmitter(const Program &prog, std::ostream &os)
+      : prog(prog), os(os) {}
+
+  void emit(const std::string &source) {
+    os << "/* generated by turing --emit-cpp from " << source
+       << " */\n";
+    emitPrelude();
+    emitRun();
+    emitMain();
+  }
+};
+
+/* run the machine from its current configuration and print
+ * the result */
+template <class Machine>
+void runAndPrint(Machine &TM) {
+  std::string result = TM.run();
+  if (TM.verdict()) result = TM.verdict();
+  if (opt::verbose) {
+    /* clang-format off */
+    std::cout << "Result: " << result << "\n";
+    std::cout << "==================== END ====================\n";
+    /* clang-format on */
+  } else {
+    std::cout << result << "\n";
+  }
+}
+
+/* run input on the machine from its initial configuration
+ * and print the result, in batch mode an illegal input still
+ * produces one line so that results stay aligned */
+template <class Machine>
+bool runInput(TMParser &parser, Machine &TM,
+    const std::string &input) {
+  if (!parser.validate_input(
+          input, !opt::batch || opt::verbose)) {
+    if (opt::batch) std::cout << "illegal input\n";
+    return false;
+  }
+
+  if (opt::verbose) {
+    /* clang-format off */
+    std::cout << "Input: " << input << "\n";
+    std::cout << "==================== RUN ====================\n";
+    /* clang-format on */
+  }
+
+  TM.reset();
+  TM.set_input(input);
+#ifdef DEBUG
+  TM.dump();
+#endif
+
+  runAndPrint(TM);
+  return true;
+}
+
+/* runs a batch of inputs on a pool of threads sharing one
+ * Program. Every worker owns a range of input indices, takes
+ * inputs from its front and, once empty, steals the upper
+ * half of another worker's range, so a few long runs do not
+ * leave the other cores idle */
+template <class TapeT>
+class BatchRunner {
+  struct WorkRange {
+    std::mutex m;
+    size_t begin = 0, end = 0;
+  };
+
+  const TMParser &parser;
+  std::shared_ptr<const Program> prog;
+  std::vector<WorkRange> ranges;
+
+  static bool pop(WorkRange &r, size_t &i) {
+    std::lock_guard<std::mutex> lock(r.m);
+    if (r.begin >= r.end) return false;
+    i = r.begin++;
+    return true;
+  }
+
+  bool steal(unsigned self) {
+    for (unsigned k = 1; k < ranges.size(); k++) {
+      WorkRange &victim =
+          ranges[(self + k) % ranges.size()];
+      size_t begin, end;
+      {
+        std::lock_guard<std::mutex> lock(victim.m);
+        if (victim.begin >= victim.end) continue;
+        end = victim.end;
+        begin =
+            victim.begin + (victim.end - victim.begin) / 2;
+        victim.end = begin;
+      }
+      std::lock_guard<std::mutex> lock(ranges[self].m);
+      ranges[self].begin = begin;
+      ranges[self].end = end;
+      return true;
+    }
+    return false;
+  }
+
+  void work(unsigned self,
+      const std::vector<std::string> &inputs,
+      std::vector<std::string> &results) {
+    BasicTuringMachine<TapeT> TM(prog);
+    size_t i;
+    do {
+      while (pop(ranges[self], i)) {
+        if (!parser.validate_input(inputs[i], false)) {
+          results[i] = "illegal input";
+          continue;
+        }
+        TM.reset();
+        TM.set_input(inputs[i]);
+        results[i] = TM.run();
+        if (TM.verdict()) results[i] = TM.verdict();
+      }
+    } while (steal(self));
+  }
+
+public:
+  BatchRunner(const TMParser &parser,
+      std::shared_ptr<const Program> prog, unsigned nThreads)
+      : parser(parser), prog(prog), ranges(nThreads) {}
+
+  /* results[i] is the result of inputs[i] */
+  void run(const std::vector<std::string> &inputs,
+      std::vector<std::string> &results) {
+    results.assign(inputs.size(), "");
+    size_t n = ranges.size();
+    for (size_t i = 0; i < n; i++) {
+      ranges[i].begin = inputs.size() * i / n;
+      ranges[i].end = inputs.size() * (i + 1) / n;
+    }
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < n; i++)
+      threads.emplace_back([this, i, &inputs, &results]() {
+        work(i, inputs, results);
+      });
+    for (auto &t : threads) t.join();
+  }
+};
+
+/* time-travel debugger (--debug). Every step taken is logged
+ * as the id of its transition, run-length encoded, which is
+ * all it takes to undo it, and the configuration is copied
+ * every K steps. Any step is then reached from the nearest
+ * copy in at most K steps, forward or back. Commands are read
+ * one per line:
+ *   s [N]               N steps forward, 1 by default
+ *   b [N]               N steps back
+ *   g N                 go to step N
+ *   c                   run until the machine stops
+ *   until state Q       run until the state is Q
+ *   until sym X [I]     run until head I reads X
+ *   back state Q        the same, backwards
+ *   back sym X [I]
+ *   p                   print the configuration
+ *   q                   quit
+ */
+template <class TapeT>
+class Debugger {
+public:
+  /* head i reads sym, or the state is state if sym is 0 */
+  struct Condition {
+    unsigned state = 0;
+    char sym = 0;
+    unsigned tape = 0;
+  };
+
+private:
+  struct Entry {
+    uint32_t tid;
+    uint32_t count; // consecutive steps taking it
+  };
+  struct Copy {
+    Configuration config;
+    size_t entry; // of the step before, and its first step
+    uint64_t entryStart;
+  };
+
+  BasicTuringMachine<TapeT> &TM;
+  const Program &prog;
+  const uint64_t every;
+  const uint64_t base; // step the session started at
+
+  std::vector<Entry> log;
+  uint64_t recorded; // steps are logged up to here
+  bool ended = false; // no step after recorded
+  std::vector<Copy> copies; // copies[k] at base + k * every
+  uint64_t nextCopy;
+
+  /* entry of the last lookup and its first step, moved one
+   * entry at a time since lookups are mostly sequential */
+  size_t hint = 0;
+  uint64_t hintStart;
+
+  uint32_t tidAt(uint64_t step) {
+    while (step < hintStart) {
+      hint--;
+      hintStart -= log[hint].count;
+    }
+    while (step >= hintStart + log[hint].count) {
+      hintStart += log[hint].count;
+      hint++;
+    }
+    return log[hint].tid;
+  }
+
+  void append(uint32_t tid, uint64_t count) {
+    while (count) {
+      if (!log.size() || log.back().tid != tid ||
+          log.back().count == UINT32_MAX)
+        log.push_back(Entry{tid, 0});
+      uint64_t k = std::min<uint64_t>(
+          count, UINT32_MAX - log.back().count);
+      log.back().count += k;
+      count -= k;
+    }
+  }
+
+  void copy() {
+    Copy c;
+    TM.get_config(c.config);
+    c.entry = log.size() ? log.size() - 1 : 0;
+    c.entryStart =
+        recorded - (log.size() ? log.back().count : 0);
+    copies.push_back(std::move(c));
+    nextCopy += every;
+  }
+
+  bool parseCondition(std::istream &is, Condition &c) const {
+    std::string what, arg;
+    if (!(is >> what >> arg)) return false;
+    if (what == "state") {
+      const auto &names = prog.stateStrings;
+      auto it = std::find(names.begin(), names.end(), arg);
+      if (it == names.end()) return false;
+      c.state = it - names.begin();
+      return true;
+    }
+    if (what != "sym" || arg.size() != 1) return false;
+    c.sym = arg[0];
+    if (!(is >> c.tape)) c.tape = 0;
+    return c.tape < prog.nTapes;
+  }
+
+public:
+  Debugger(BasicTuringMachine<TapeT> &TM, uint64_t every)
+      : TM(TM), prog(TM.get_program()),
+        every(std::max<uint64_t>(every, 1)),
+        base(TM.get_steps()), recorded(base), nextCopy(base),
+        hintStart(base) {
+    copy();
+  }
+
+  /* false if the machine has stopped */
+  bool forward() { return advance(1); }
+
+  /* up to n steps forward in batches, which end where the log
+   * does and at copies. With c it stops after a step where c
+   * holds. False if the machine stopped first */
+  bool advance(uint64_t n, const Condition *c = nullptr) {
+    auto until = [this, c]() { return c && holds(*c); };
+    /* c cannot hold inside a sweep over cells unlike it */
+    auto skippable = [this, c](uint32_t tid) {
+      if (!c) return true;
+      if (!c->sym) return TM.get_state() != c->state;
+      const auto &step = prog.delta.stepsOf(tid)[c->tape];
+      char ch = step.shift ? TM.get_tape(c->tape).get()
+                           : step.sym;
+      return ch != c->sym;
+    };
+
+    while (n) {
+      uint64_t cur = TM.get_steps();
+      if (cur == recorded && ended) return false;
+      const bool logging = cur == recorded;
+      uint64_t k = std::min(
+          n, logging ? nextCopy - recorded : recorded - cur);
+      uint64_t taken = TM.stepBatch(
+          k,
+          [this, logging](uint32_t tid, uint64_t count) {
+            if (logging) append(tid, count);
+          },
+          until, skippable);
+      n -= taken;
+      if (logging) {
+        recorded += taken;
+        if (taken && prog.delta.stopsAt(TM.get_state()))
+          ended = true;
+        if (recorded == nextCopy) copy();
+      }
+      if (taken && until()) return true;
+      if (taken < k) {
+        if (logging) ended = true;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /* false at the first step of the session */
+  bool back() {
+    uint64_t n = TM.get_steps();
+    if (n == base) return false;
+    TM.undoStep(tidAt(n - 1));
+    return true;
+  }
+
+  void goTo(uint64_t n) {
+    n = std::max(n, base);
+    uint64_t cur = TM.get_steps();
+    if (n < cur && cur - n > every) {
+      const Copy &c = copies[(n - base) / every];
+      TM.set_config(c.config);
+      hint = c.entry;
+      hintStart = c.entryStart;
+    }
+    while (TM.get_steps() > n) back();
+    if (TM.get_steps() < n) advance(n - TM.get_steps());
+  }
+
+  bool holds(const Condition &c) const {
+    if (!c.sym) return TM.get_state() == c.state;
+    return TM.get_tape(c.tape).get() == c.sym;
+  }
+
+  /* false if the start or the end came first */
+  bool runUntil(const Condition &c, bool backwards) {
+    if (!backwards) return advance(UINT64_MAX, &c);
+    do {
+      if (!back()) return false;
+    } while (!holds(c));
+    return true;
+  }
+
+  void repl(std::istream &is) {
+    TM.printOneStep();
+    std::string line;
+    while (std::getline(is, line)) {
+      std::istringstream cmd(line);
+      std::string op;
+      if (!(cmd >> op)) continue;
+
+      uint64_t n = 1;
+      bool moved = true;
+      if (op == "s") {
+        cmd >> n;
+        moved = advance(n);
+      } else if (op == "b") {
+        cmd >> n;
+        for (uint64_t k = 0; k < n && moved; k++)
+          moved = back();
+      } else if (op == "g" && cmd >> n) {
+        goTo(n);
+      } else if (op == "c") {
+        advance(UINT64_MAX);
+        moved = false;
+      } else if (op == "until" || op == "back") {
+        Condition c;
+        if (!parseCondition(cmd, c)) {
+          std::cout << "bad condition '" << line << "'\n";
+          continue;
+        }
+        moved = runUntil(c, op == "back");
+      } else if (op == "q") {
+        return;
+      } else if (op != "p") {
+        std::cout << "unknown command '" << op << "'\n";
+        continue;
+      }
+
+      if (!moved)
+        std::cout << (TM.get_steps() == base ? "at the start\n"
+                                             : "stopped\n");
+      TM.printOneStep();
+    }
+  }
+};
+
+/* the --heatmap file, a summary goes to stderr. The file
+ * holds "TMHEAT1\0", u32 tapes, then for every tape
+ *   u32 shift, i64 first cell, u64 buckets, u64 visits,
+ *   u64 moves, u64 reversals, u64 sweeps[64],
+ *   u64 visits[buckets]
+ * in host byte order, bucket j covers the 2^shift cells from
+ * first + j * 2^shift on and sweeps[c] counts the sweeps of
+ * 2^c to 2^(c+1) - 1 cells */
+template <class TapeT>
+bool writeHeatmap(const BasicTuringMachine<TapeT> &) {
+  return true;
+}
+
+template <class TapeT>
+bool writeHeatmap(const BasicTuringMachine<HeatTape<TapeT>> &TM) {
+  std::string out("TMHEAT1", 8);
+  auto put = [&out](auto v) {
+    out.append((const char *)&v, sizeof(v));
+  };
+  const unsigned n = TM.get_program().nTapes;
+  put(uint32_t(n));
+  for (unsigned i = 0; i < n; i++) {
+    TapeHeat h = TM.get_tape(i).heat();
+    h.stop();
+    const int64_t width = int64_t(1) << h.shift;
+    put(uint32_t(h.shift));
+    put(int64_t(h.first * width));
+    put(uint64_t(h.buckets.size()));
+    put(h.visits);
+    put(h.moves);
+    put(h.reversals);
+    for (uint64_t c : h.sweeps) put(c);
+    for (uint64_t c : h.buckets) put(c);
+
+    uint64_t sweeps = 0;
+    for (uint64_t c : h.sweeps) sweeps += c;
+    std::cerr << formatv(
+        "tape %s: %s visits in cells [%s, %s), %s reversals, "
+        "mean sweep %s\n",
+        i, h.visits, h.first * width,
+        (h.first + (int64_t)h.buckets.size()) * width,
+        h.reversals, sweeps ? double(h.moves) / sweeps : 0.0);
+    if (h.buckets.size()) {
+      size_t hot = std::max_element(h.buckets.begin(),
+                       h.buckets.end()) -
+                   h.buckets.begin();
+      int64_t from = (h.first + (int64_t)hot) * width;
+      std::cerr << formatv(
+          "  hottest cells [%s, %s): %s visits\n", from,
+          from + width, h.buckets[hot]);
+    }
+    for (unsigned c = 0; c < 64; c++) {
+      if (!h.sweeps[c]) continue;
+      uint64_t lo = uint64_t(1) << c;
+      std::string len = c ? formatv("%s-%s", lo, 2 * lo - 1)
+                          : std::string("1");
+      std::cerr << formatv("  sweeps of %s: %s\n", len,
+          h.sweeps[c]);
+    }
+  }
+
+  std::ofstream os(opt::heatmap, std::ios::binary);
+  os.write(out.data(), out.size());
+  if (!os.flush()) {
+    std::cerr << "cannot write '" << opt::heatmap << "'\n";
+    return false;
+  }
+  return true;
+}
+
+/* the --profile report, hottest transitions go to stderr */
+bool writeProfile(const Profiler &p) {
+  std::ofstream os(opt::profile);
+  p.writeJson(os);
+  p.writeTable(std::cerr, 20);
+  if (!os.flush()) {
+    std::cerr << "cannot write '" << opt::profile << "'\n";
+    return false;
+  }
+  return true;
+}
+
+/* single input or batch run on tapes of type TapeT */
+template <class TapeT>
+int runMain(TMParser &parser,
+    std::shared_ptr<const Program> prog, const char *input) {
+  BasicTuringMachine<TapeT> TM(prog);
+  if (opt::restore && !TM.restore(opt::restore)) {
+    std::cerr << "cannot restore '" << opt::restore << "'\n";
+    return 1;
+  }
+
+  if (opt::debug) {
+    /* from the snapshot, or from the input */
+    if (!opt::restore) {
+      if (!parser.validate_input(input)) return 1;
+      TM.reset();
+      TM.set_input(input);
+    }
+    Debugger<TapeT>(TM, opt::debug_every).repl(std::cin);
+    return 0;
+  }
+
+  Profiler profiler(*prog);
+  if (opt::profile) TM.set_profile(&profiler);
+  /* 1 if a report cannot be written */
+  auto report = [&]() {
+    return (opt::profile && !writeProfile(profiler)) ||
+           !writeHeatmap(TM);
+  };
+
+  if (!opt::batch) {
+    TraceWriter trace(opt::trace_every);
+    if (opt::trace) {
+      if (!trace.open(
+              opt::trace, prog->fingerprint(), prog->nTapes)) {
+        std::cerr << "cannot open '" << opt::trace << "'\n";
+        return 1;
+      }
+      TM.set_trace(&trace);
+    }
+
+    if (!opt::restore) {
+      if (!runInput(parser, TM, input)) return 1;
+    } else {
+      if (opt::verbose) {
+        /* clang-format off */
+        std::cout << "==================== RUN ====================\n";
         /* clang-format on */
-      } else {
-        std::cerr << "illegal input\n";
       }
-      return false;
+      runAndPrint(TM);
     }
-    return true;
+    if (!trace.finish()) {
+      std::cerr << "cannot write '" << opt::trace << "'\n";
+      return 1;
+    }
+    return report();
   }
 
-  TuringMachine parseTMFile(std::istream &is) {
-    wrapped_istream wis(is);
-    // a naive parser
-    unsigned preseted_nTapes = -1;
-    while (wis.good()) {
-      erase_blank(wis);
-      pdbg("[mainloop] erase initial blank, '%s'\n",
-          wis.peek());
+  /* one input per line, the machine is parsed only once */
+  std::ifstream inputs;
+  if (input) {
+    inputs.open(input);
+    if (!inputs) {
+      std::cerr << "cannot open '" << input << "'\n";
+      return 1;
+    }
+  }
+  std::istream &is = input ? inputs : std::cin;
+  std::ios::sync_with_stdio(false);
 
-      if (wis.endl()) {
-        pdbg(
-            "[mainloop.endl] meet endl '%s'\n", wis.peek());
-        wis.get();
-      } else if (wis.peek() == '#') {
-        wis.ignore();
-        erase_blank(wis);
-        pdbg("[mainloop.#] after erase blank '%s'\n",
-            wis.peek());
-        char ch = wis.get();
-        switch (ch) {
-        case 'Q':
-        case 'S':
-        case 'G':
-        case 'F': {
-          erase_blank_until(wis, '=');
-          pdbg("[mainloop.#|=] after erase blank '%s'\n",
-              wis.peek());
-          std::vector<StringToken> sv =
-              (ch == 'Q' || ch == 'F')
-                  ? parseStateArray(wis)
-                  : (ch == 'S' ? parseInputSymbolArray(wis)
-                               : parseTapeSymbolArray(wis));
+  std::string line;
+  /* one profile covers all inputs */
+  if (opt::jobs <= 1 || opt::verbose || opt::profile ||
+      opt::heatmap) {
+    while (std::getline(is, line)) {
+      if (line.size() && line.back() == '\r') line.pop_back();
+      runInput(parser, TM, line);
+    }
+    return report();
+  }
 
-          if (ch == 'Q') {
-            states = std::move(sv);
-            unsigned counter = 0;
-            for (const StringToken &state : states)
-              stateIdMap[state] = counter++;
-          } else if (ch == 'F') {
-            finalStates = std::move(sv);
-          } else if (ch == 'S') {
-            for (const StringToken &symbol : sv) {
-              if (symbol.size() > 1) {
-                report_error(symbol,
-                    "expected only one character as symbol "
-                    "in #S",
-                    wis);
-              }
-            }
-            inputSymbolSet = std::move(sv);
-          } else if (ch == 'G') {
-            for (const StringToken &symbol : sv) {
-              if (symbol.size() > 1) {
-                report_error(symbol,
-                    "expected only one character as symbol "
-                    "in #G",
-                    wis);
-              }
-            }
-            tapeSymbolSet = std::move(sv);
-          }
-        } break;
-        case 'q':
-          if ((ch = wis.get()) != '0') {
-            report_error_here(
-                formatv("expected #q0 here, not #q%s", ch),
-                wis);
-          }
-          erase_blank_until(wis, '=');
-          erase_blank(wis);
-          pdbg("[mainloop.#q0] next '%s'\n", wis.peek());
-          initState = parseState(wis);
-          break;
-        case 'B':
-          erase_blank_until(wis, '=');
-          erase_blank(wis);
-          blankSymbol = parseState(wis);
-          if (blankSymbol.size() != 1)
-            report_error(blankSymbol,
-                "blank symbol size <> 1\n", wis);
-          if (blankSymbol.empty())
-            blankSymbol.push_back('_');
-          break;
-        case 'N': {
-          erase_blank_until(wis, '=');
-          erase_blank(wis);
-          unsigned n = 0;
-          while (wis.good() && std::isdigit(ch = wis.get()))
-            n = (ch - '0') + n * 10;
-          if (nTapes != -1u) {
-            report_error_here(
-                formatv("#N has been deduced to be %s from "
-                        "delta function",
-                    nTapes),
-                wis);
-          }
-          nTapes = n;
-          preseted_nTapes = n;
-        } break;
-        default: {
-          StringToken tok(" ");
-          tok.lineno = wis.get_lineno();
-          tok.column = wis.get_column() - 1;
-          report_error(
-              tok, formatv("unexpected #%s", ch), wis);
-        } break;
-        }
+  /* inputs are run in blocks so that results can be written
+   * back in input order without holding the whole stream */
+  const size_t block = 1 << 16;
+  BatchRunner<TapeT> runner(parser, prog, opt::jobs);
+  std::vector<std::string> lines, results;
+  while (is) {
+    lines.clear();
+    while (lines.size() < block && std::getline(is, line)) {
+      if (line.size() && line.back() == '\r') line.pop_back();
+      lines.push_back(std::move(line));
+    }
 
-        while (!wis.endl()) wis.ignore();
-        wis.ignore();
-      } else {
-        pdbg("[mainloop.action], next '%s'\n", wis.peek());
-        DeltaEntry e;
-        e.curState = parseState(wis);
-        pdbg("[mainloop.action.State] '%s'\n",
-            std::string(e.curState));
-        erase_blank(wis);
-        e.curSymbols = parseTapeSymbol(wis);
-        pdbg("[mainloop.action.CurSym] '%s'\n",
-            std::string(e.curSymbols));
-        erase_blank(wis);
-        e.nxtSymbols = parseTapeSymbol(wis);
-        pdbg("[mainloop.action.NxtSym] '%s'\n",
-            std::string(e.nxtSymbols));
-        erase_blank(wis);
-        e.actions = parseActions(wis);
-        pdbg("[mainloop.action.Actions] '%s'\n",
-            std::string(e.actions));
-        erase_blank(wis);
-        e.nxtState = parseState(wis);
-        while (!wis.endl()) wis.ignore();
-        wis.ignore();
-        delta.push_back(e);
-
-        const std::vector<const StringToken *> sv = {
-            &e.curSymbols, &e.nxtSymbols, &e.actions};
-        for (const StringToken *stp : sv) {
-          unsigned old = nTapes;
-          nTapes = std::min<unsigned>(stp->size(), nTapes);
-          if (preseted_nTapes != -1u &&
-              preseted_nTapes != stp->size()) {
-            report_error(*stp,
-                formatv(
-                    "#N=%s, size %s here is inconsistent, "
-                    "we adjust #N to %s as minimum value",
-                    preseted_nTapes, stp->size(), nTapes),
-                wis);
-          } else if (old != -1u && old != stp->size()) {
-            report_error(*stp,
-                formatv(
-                    "deduced #N=%s, size %s here is "
-                    "inconsistent, "
-                    "we adjust #N to %s as minimum value",
-                    old, stp->size(), nTapes),
-                wis);
-          }
-        }
+    runner.run(lines, results);
+    for (const std::string &result : results)
+      std::cout << result << "\n";
+  }
+  return 0;
+}
 
-        for (unsigned i = 0; i < e.actions.size(); i++) {
-          char a = e.actions[i];
-          if (a != 'l' && a != 'r' && a != '*') {
-            StringToken tok(" ");
-            tok.lineno = e.actions.lineno;
-            tok.column = e.actions.column + i;
-            report_error(tok, "expected l, r, * here", wis);
-          }
-        }
+/* runMain on TapeT, counting its accesses with --heatmap */
+template <class TapeT>
+int runTapes(TMParser &parser,
+    std::shared_ptr<const Program> prog, const char *input) {
+  if (opt::heatmap)
+    return runMain<HeatTape<TapeT>>(parser, prog, input);
+  return runMain<TapeT>(parser, prog, input);
+}
+
+/* turing-trace: prints steps from..to of a trace recorded
+ * with --trace, in the format of -v. Each block is skipped
+ * unless it holds a step to print, then replayed from its
+ * keyframe */
+int traceMain(int argc, const char *argv[]) {
+  if (argc < 3) {
+    std::cout << "usage: turing-trace <tm> <trace> "
+                 "[<from> [<to>]]\n";
+    return 1;
+  }
+  uint64_t from = argc > 3 ? strtoull(argv[3], nullptr, 10) : 0;
+  uint64_t to =
+      argc > 4 ? strtoull(argv[4], nullptr, 10) : UINT64_MAX;
+
+  TMParser parser;
+  auto prog = parser.parseFile(argv[1]);
+  TuringMachine TM(prog);
+
+  std::ifstream is(argv[2], std::ios::binary);
+  auto get = [&is](auto &v) {
+    return bool(is.read((char *)&v, sizeof(v)));
+  };
+  char magic[8];
+  uint64_t program, every;
+  uint32_t nTapes;
+  if (!is.read(magic, sizeof(magic)) ||
+      memcmp(magic, TraceWriter::magic, sizeof(magic)) ||
+      !get(program) || !get(every) || !get(nTapes) ||
+      nTapes != prog->nTapes) {
+    std::cerr << "'" << argv[2] << "' is not a trace\n";
+    return 1;
+  }
+  if (program != prog->fingerprint()) {
+    std::cerr << "'" << argv[2] << "' was not recorded from '"
+              << argv[1] << "'\n";
+    return 1;
+  }
+
+  Configuration c;
+  c.heads.resize(nTapes);
+  c.starts.resize(nTapes);
+  c.contents.resize(nTapes);
+  std::string tids;
+  uint64_t next = from; // step to print next
+  while (next <= to && get(c.steps)) {
+    uint32_t state;
+    uint64_t count, bytes;
+    get(state);
+    c.state = state;
+    for (unsigned i = 0; i < nTapes; i++) {
+      int64_t len = -1;
+      get(c.heads[i]);
+      get(c.starts[i]);
+      if (!get(len) || len < 0 || len > (int64_t(1) << 40)) {
+        std::cerr << "'" << argv[2] << "' is corrupt\n";
+        return 1;
       }
+      c.contents[i].resize(len);
+      is.read(&c.contents[i][0], len);
     }
-    /* check state */
-    for (const StringToken &s : finalStates) {
-      if (stateIdMap.find(s) == stateIdMap.end())
-        report_error(s,
-            formatv("cannot find state '%s' in #Q from #F",
-                std::string(s)),
-            wis);
+    if (!get(count) || !get(bytes) ||
+        c.state >= prog->stateStrings.size()) {
+      std::cerr << "'" << argv[2] << "' is truncated\n";
+      return 1;
     }
-    for (const DeltaEntry &e : delta) {
-      if (stateIdMap.find(e.curState) == stateIdMap.end())
-        report_error(e.curState,
-            formatv(
-                "cannot find state '%s' in #Q from actions",
-                std::string(e.curState)),
-            wis);
-      if (stateIdMap.find(e.nxtState) == stateIdMap.end())
-        report_error(e.nxtState,
-            formatv(
-                "cannot find state '%s' in #Q from actions",
-                std::string(e.nxtState)),
-            wis);
+    if (c.steps + count < next) {
+      is.seekg(bytes, std::ios::cur);
+      continue;
     }
 
-    if (stateIdMap.find(initState) == stateIdMap.end())
-      report_error(initState,
-          formatv("cannot find state %s (=#q0) in #Q",
-              std::string(initState)),
-          wis);
-
-    if (nTapes == -1u) {
-      std::cerr << "invalid #N " << nTapes << "\n";
-      nTapes = 0u;
+    tids.resize(bytes);
+    is.read(&tids[0], bytes);
+    TM.set_config(c);
+    if (TM.get_steps() == next) {
+      TM.printOneStep();
+      next++;
     }
-
-    /* check symbols */
-    std::set<char> valid_chars;
-    for (auto &s : tapeSymbolSet)
-      valid_chars.insert(s.at(0));
-    for (const DeltaEntry &e : delta) {
-      const std::vector<const StringToken *> sv = {
-          &e.curSymbols, &e.nxtSymbols};
-      for (const StringToken *stp : sv) {
-        for (unsigned i = 0; i < stp->size(); i++) {
-          char ch = stp->at(i);
-          if (valid_chars.find(ch) != valid_chars.end())
-            continue;
-          if (ch == blankSymbol[0]) continue;
-
-          StringToken tok(" ");
-          tok.lineno = stp->lineno;
-          tok.column = stp->column + i;
-          report_error(tok,
-              formatv("symbol %s not found in #G", ch),
-              wis);
-        }
+    size_t p = 0;
+    for (uint64_t k = 0; k < count && next <= to; k++) {
+      uint32_t tid = 0;
+      for (unsigned sh = 0; p < tids.size(); sh += 7) {
+        uint8_t b = tids[p++];
+        tid |= uint32_t(b & 0x7f) << sh;
+        if (!(b & 0x80)) break;
+      }
+      if (tid >= prog->delta.size()) {
+        std::cerr << "'" << argv[2] << "' is corrupt\n";
+        return 1;
       }
+      TM.applyStep(tid);
+      if (TM.get_steps() == next) {
+        TM.printOneStep();
+        next++;
+      }
+    }
+  }
+  return 0;
+}
+
+/* synthetic machines for benchmarks and stress tests, in the
+ * format read by TMParser */
+class TMGenerator {
+  std::ostream &os;
+
+  static std::string join(const std::vector<std::string> &v) {
+    std::string ret;
+    for (const std::string &s : v) {
+      if (ret.size()) ret += ",";
+      ret += s;
     }
+    return ret;
+  }
 
-#ifdef DEBUG
-    this->dump();
-#endif
+  void header(const std::vector<std::string> &states,
+      const std::string &init, const std::string &symbols,
+      unsigned nTapes) {
+    std::vector<std::string> input, tape;
+    for (char ch : symbols) input.push_back(std::string(1, ch));
+    tape = input;
+    tape.push_back("_");
+    os << "#Q = {" << join(states) << "}\n"
+       << "#S = {" << join(input) << "}\n"
+       << "#G = {" << join(tape) << "}\n"
+       << "#q0 = " << init << "\n#B = _\n#F = {h}\n"
+       << "#N = " << nTapes << "\n\n";
+  }
 
-    if (found_error) exit(1);
+  void rule(const std::string &from, const std::string &read,
+      const std::string &write, const std::string &move,
+      const std::string &to) {
+    os << from << " " << read << " " << write << " " << move
+       << " " << to << "\n";
+  }
 
-    /* construct TuringMachine */
-    TuringMachine TM(nTapes, blankSymbol[0]);
-    TM.state = stateIdMap[initState];
-    for (const StringToken &s : finalStates) {
-      TM.finalStates.insert(stateIdMap[s]);
+  static std::string numbered(char prefix, unsigned i) {
+    return prefix + std::to_string(i);
+  }
+
+public:
+  TMGenerator(std::ostream &os) : os(os) {}
+
+  /* writes bits 0s and counts them up in binary until the
+   * counter overflows, about 2^(bits+2) steps */
+  void binaryCounter(unsigned bits) {
+    std::vector<std::string> states;
+    for (unsigned i = 0; i < bits; i++)
+      states.push_back(numbered('z', i));
+    for (const char *s : {"a", "i", "h"}) states.push_back(s);
+    header(states, bits ? "z0" : "i", "01", 1);
+    for (unsigned i = 0; i + 1 < bits; i++)
+      rule(states[i], "_", "0", "r", states[i + 1]);
+    if (bits) rule(states[bits - 1], "_", "0", "*", "i");
+    rule("i", "1", "0", "l", "i");
+    rule("i", "0", "1", "r", "a");
+    rule("i", "_", "_", "*", "h");
+    rule("a", "0", "0", "r", "a");
+    rule("a", "1", "1", "r", "a");
+    rule("a", "_", "_", "l", "i");
+  }
+
+  /* writes n 1s and erases them from both ends in turn, about
+   * n^2 / 2 steps */
+  void unaryCounter(unsigned n) {
+    std::vector<std::string> states;
+    for (unsigned i = 0; i < n; i++)
+      states.push_back(numbered('w', i));
+    for (const char *s : {"a", "b", "c", "d", "h"})
+      states.push_back(s);
+    header(states, n ? "w0" : "a", "1", 1);
+    for (unsigned i = 0; i + 1 < n; i++)
+      rule(states[i], "_", "1", "r", states[i + 1]);
+    if (n) rule(states[n - 1], "_", "1", "l", "d");
+    rule("a", "1", "_", "r", "b");
+    rule("a", "_", "_", "*", "h");
+    rule("b", "1", "1", "r", "b");
+    rule("b", "_", "_", "l", "c");
+    rule("c", "1", "_", "l", "d");
+    rule("c", "_", "_", "*", "h");
+    rule("d", "1", "1", "l", "d");
+    rule("d", "_", "_", "r", "a");
+  }
+
+  /* copies the input of tape 0 to tapes 1..k-1, and with
+   * compare then checks tape 0 against every copy read
+   * backwards, halting in h for palindromes */
+  void copy(unsigned k, bool compare) {
+    k = std::max(k, 2u);
+    const std::string stay(k - 1, '*'), right(k, 'r');
+    const std::string blanks(k, '_');
+    if (compare)
+      header({"cp", "rw", "cmp", "h"}, "cp", "01", k);
+    else
+      header({"cp", "h"}, "cp", "01", k);
+
+    for (char s : std::string("01"))
+      rule("cp", s + std::string(k - 1, '_'),
+          std::string(k, s), right, "cp");
+    if (!compare) {
+      rule("cp", blanks, blanks, std::string(k, '*'), "h");
+      return;
     }
+    rule("cp", blanks, blanks, std::string(k, 'l'), "rw");
 
-    for (const StringToken &s : states)
-      TM.stateStrings.emplace_back(s);
+    /* back to the start of tape 0, the copies stay at their
+     * last symbol */
+    for (char a : std::string("01"))
+      for (char b : std::string("01"))
+        rule("rw", a + std::string(k - 1, b),
+            a + std::string(k - 1, b), "l" + stay, "rw");
+    for (char b : std::string("01_"))
+      rule("rw", "_" + std::string(k - 1, b),
+          "_" + std::string(k - 1, b), "r" + stay, "cmp");
 
-    for (const DeltaEntry &e : delta) {
-      unsigned cur_state = stateIdMap[e.curState];
-      TM.delta.resize(std::max<unsigned>(
-          TM.delta.size(), cur_state + 1));
-      std::vector<char> cur_symvec(e.curSymbols.begin(),
-          e.curSymbols.begin() + nTapes);
-      std::vector<std::pair<char, char>> nxtSym_action_vec;
-      for (unsigned i = 0; i < nTapes; i++)
-        nxtSym_action_vec.emplace_back(
-            e.nxtSymbols[i], e.actions[i]);
+    for (char s : std::string("01"))
+      rule("cmp", std::string(k, s), std::string(k, s),
+          "r" + std::string(k - 1, 'l'), "cmp");
+    rule("cmp", blanks, blanks, std::string(k, '*'), "h");
+  }
+
+  /* a chain of n states, each with a transition for every
+   * symbol, that runs n steps on any input */
+  void chain(unsigned n) {
+    std::vector<std::string> states;
+    for (unsigned i = 0; i < n; i++)
+      states.push_back(numbered('q', i));
+    states.push_back("h");
+    header(states, states[0], "01", 1);
+    for (unsigned i = 0; i < n; i++)
+      for (const char *rw : {"01", "10", "_1"})
+        rule(states[i], std::string(1, rw[0]),
+            std::string(1, rw[1]), "r", states[i + 1]);
+  }
 
-      auto &info = TM.delta[cur_state][cur_symvec];
-      info.nxtStep = std::move(nxtSym_action_vec);
-      info.nxtState = stateIdMap[e.nxtState];
+  /* a transition for every state and every tuple of symbols,
+   * with random writes, moves and next states, h about once
+   * per 16 transitions. The same seed gives the same machine */
+  bool random(unsigned nStates, unsigned nSymbols,
+      unsigned nTapes, uint64_t seed) {
+    static const char names[] =
+        "0123456789abcdefghijklmnopqrstuvwxyz";
+    const std::string symbols(
+        names, std::min<size_t>(nSymbols, sizeof(names) - 1));
+    const std::string tape = symbols + "_";
+    uint64_t tuples = 1;
+    for (unsigned i = 0; i < nTapes; i++) {
+      tuples *= tape.size();
+      if (tuples * nStates > (1u << 24)) return false;
     }
-    return TM;
+    if (!nStates || symbols.empty() || !nTapes) return false;
+
+    std::vector<std::string> states;
+    for (unsigned i = 0; i < nStates; i++)
+      states.push_back(numbered('r', i));
+    states.push_back("h");
+    header(states, states[0], symbols, nTapes);
+
+    std::mt19937_64 rng(seed);
+    std::string read(nTapes, ' '), write(nTapes, ' ');
+    std::string move(nTapes, ' ');
+    for (unsigned s = 0; s < nStates; s++)
+      for (uint64_t t = 0; t < tuples; t++) {
+        uint64_t x = t;
+        for (unsigned i = 0; i < nTapes; i++) {
+          read[i] = tape[x % tape.size()];
+          x /= tape.size();
+          write[i] = tape[rng() % tape.size()];
+          move[i] = "lr*"[rng() % 3];
+        }
+        unsigned next = rng() % 16 ? rng() % nStates : nStates;
+        rule(states[s], read, write, move, states[next]);
+      }
+    return true;
   }
 };
 
+/* tmgen: writes a synthetic machine, or inputs for a machine,
+ * to stdout */
+int tmgenMain(int argc, const char *argv[]) {
+  auto arg = [argc, argv](int i, uint64_t dflt) {
+    return i < argc ? strtoull(argv[i], nullptr, 10) : dflt;
+  };
+  std::string kind = argc > 1 ? argv[1] : "";
+  std::ios::sync_with_stdio(false);
+  TMGenerator gen(std::cout);
+
+  if (kind == "counter" && argc > 3 &&
+      strcmp(argv[2], "binary") == 0) {
+    gen.binaryCounter(arg(3, 0));
+  } else if (kind == "counter" && argc > 3 &&
+             strcmp(argv[2], "unary") == 0) {
+    gen.unaryCounter(arg(3, 0));
+  } else if ((kind == "copy" || kind == "compare") && argc > 2) {
+    gen.copy(arg(2, 2), kind == "compare");
+  } else if (kind == "states" && argc > 2) {
+    gen.chain(std::max<uint64_t>(arg(2, 1), 1));
+  } else if (kind == "random" && argc > 4) {
+    if (!gen.random(arg(2, 0), arg(3, 0), arg(4, 0), arg(5, 1))) {
+      std::cerr << "no machine of that size\n";
+      return 1;
+    }
+  } else if (kind == "inputs" && argc > 4) {
+    /* random words over #S, every other one a palindrome */
+    std::ifstream ifs(argv[2]);
+    if (!ifs) {
+      std::cerr << "cannot open '" << argv[2] << "'\n";
+      return 1;
+    }
+    TMParser parser;
+    auto prog = parser.parseFile(argv[2]);
+    std::string symbols;
+    for (char ch : prog->inputSymbols)
+      if (ch != prog->blank) symbols.push_back(ch);
+    if (symbols.empty()) symbols.push_back(prog->blank);
+
+    std::mt19937_64 rng(arg(5, 1));
+    uint64_t count = arg(3, 0), length = arg(4, 0);
+    std::string line(length, ' ');
+    for (uint64_t k = 0; k < count; k++) {
+      for (char &ch : line) ch = symbols[rng() % symbols.size()];
+      if (k % 2)
+        std::copy(line.begin(), line.begin() + length / 2,
+            line.rbegin());
+      std::cout << line << "\n";
+    }
+  } else {
+    std::cout
+        << "usage: tmgen counter binary|unary <n>\n"
+           "       tmgen copy|compare <tapes>\n"
+           "       tmgen states <n>\n"
+           "       tmgen random <states> <symbols> <tapes> "
+           "[<seed>]\n"
+           "       tmgen inputs <tm> <count> <length> [<seed>]\n";
+    return 1;
+  }
+  return std::cout.flush() ? 0 : 1;
+}
+
 int main(int argc, const char *argv[]) {
+  /* the tools are this program under other names */
+  const char *name = strrchr(argv[0], '/');
+  name = name ? name + 1 : argv[0];
+  if (strcmp(name, "turing-trace") == 0) {
+    /* here, before anything is printed or cout redirected */
+    std::ios::sync_with_stdio(false);
+    return traceMain(argc, argv);
+  }
+  if (strcmp(name, "tmgen") == 0) return tmgenMain(argc, argv);
+
   const char *help =
-      "usage: turing [-v|--verbose] [-h|--help] <tm> "
-      "<input>";
+      "usage: turing [-v|--verbose] [-h|--help] [--jit] "
+      "[--macro] [--macro-block N] [--no-skip] [--detect] "
+      "[--tape flat|rle|paged|packed] [--tape-mem MiB] "
+      "[--max-steps N] [--max-tape-cells N] [--timeout SEC] "
+      "[--heartbeat SEC] "
+      "[--checkpoint FILE [--checkpoint-every SEC]] "
+      "<tm> <input>\n"
+      "       turing [options] --restore FILE <tm>\n"
+      "       turing --debug [--debug-every K] <tm> <input>\n"
+      "       turing --trace FILE [--trace-every K] <tm> <input>\n"
+      "       turing --profile FILE [--batch] <tm> <input>\n"
+      "       turing --heatmap FILE [--batch] <tm> <input>\n"
+      "       turing-trace <tm> <trace> [<from> [<to>]]\n"
+      "       turing --batch [-v|--verbose] [-j|--jobs N] "
+      "<tm> [<input-file>]\n"
+      "       turing --emit-cpp <tm> [<output>]";
   if (argc <= 1) {
     std::cout << help << "\n";
     return 1;
@@ -990,6 +5327,88 @@ int main(int argc, const char *argv[]) {
     } else if (strcmp(argv[i], "-v") == 0 ||
                strcmp(argv[i], "--verbose") == 0) {
       opt::verbose = 1;
+    } else if (strcmp(argv[i], "--batch") == 0) {
+      opt::batch = 1;
+    } else if (strcmp(argv[i], "--emit-cpp") == 0) {
+      opt::emit_cpp = 1;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      opt::jit = 1;
+    } else if (strcmp(argv[i], "--detect") == 0) {
+      opt::detect = 1;
+    } else if (strcmp(argv[i], "--no-skip") == 0) {
+      opt::skip = 0;
+    } else if (strcmp(argv[i], "--macro") == 0) {
+      opt::macro = 1;
+    } else if (strcmp(argv[i], "--macro-block") == 0 &&
+               i + 1 < argc) {
+      opt::macro = 1;
+      opt::macro_block = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--tape") == 0 &&
+               i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "flat") == 0) {
+        opt::tape = opt::TAPE_FLAT;
+      } else if (strcmp(argv[i], "rle") == 0) {
+        opt::tape = opt::TAPE_RLE;
+      } else if (strcmp(argv[i], "paged") == 0) {
+        opt::tape = opt::TAPE_PAGED;
+      } else if (strcmp(argv[i], "packed") == 0) {
+        opt::tape = opt::TAPE_PACKED;
+      } else {
+        std::cerr << "unknown tape '" << argv[i] << "'\n";
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--tape-mem") == 0 &&
+               i + 1 < argc) {
+      opt::tape = opt::TAPE_PAGED;
+      opt::tape_mem = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-steps") == 0 &&
+               i + 1 < argc) {
+      opt::max_steps = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--max-tape-cells") == 0 &&
+               i + 1 < argc) {
+      opt::max_tape_cells = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--timeout") == 0 &&
+               i + 1 < argc) {
+      opt::timeout = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--heartbeat") == 0 &&
+               i + 1 < argc) {
+      opt::heartbeat = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--checkpoint") == 0 &&
+               i + 1 < argc) {
+      opt::checkpoint = argv[++i];
+    } else if (strcmp(argv[i], "--checkpoint-every") == 0 &&
+               i + 1 < argc) {
+      opt::checkpoint_every = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--debug") == 0) {
+      opt::debug = 1;
+    } else if (strcmp(argv[i], "--debug-every") == 0 &&
+               i + 1 < argc) {
+      opt::debug = 1;
+      opt::debug_every = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--trace") == 0 &&
+               i + 1 < argc) {
+      opt::trace = argv[++i];
+    } else if (strcmp(argv[i], "--trace-every") == 0 &&
+               i + 1 < argc) {
+      opt::trace_every = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--profile") == 0 &&
+               i + 1 < argc) {
+      opt::profile = argv[++i];
+    } else if (strcmp(argv[i], "--heatmap") == 0 &&
+               i + 1 < argc) {
+      opt::heatmap = argv[++i];
+    } else if (strcmp(argv[i], "--restore") == 0 &&
+               i + 1 < argc) {
+      opt::restore = argv[++i];
+    } else if ((strcmp(argv[i], "-j") == 0 ||
+                   strcmp(argv[i], "--jobs") == 0) &&
+               i + 1 < argc) {
+      /* 0 means one thread per core */
+      opt::jobs = atoi(argv[++i]);
+      if (opt::jobs == 0)
+        opt::jobs = std::max(1u,
+            std::thread::hardware_concurrency());
     } else if (!tmfile) {
       tmfile = argv[i];
     } else if (!input) {
@@ -1000,38 +5419,49 @@ int main(int argc, const char *argv[]) {
     }
   }
 
-  if (!tmfile || !input) {
+  if (!tmfile || (!input && !opt::batch && !opt::emit_cpp &&
+                     !opt::restore)) {
     std::cout << help << "\n";
     return 1;
   }
+  if ((opt::checkpoint || opt::restore) && opt::batch) {
+    std::cerr << "snapshots need a single run\n";
+    return 1;
+  }
+  if ((opt::debug || opt::trace) && opt::batch) {
+    std::cerr << "--debug and --trace need a single run\n";
+    return 1;
+  }
+#if !HAVE_MMAP
+  if (opt::checkpoint || opt::restore) {
+    std::cerr << "snapshots are not supported here\n";
+    return 1;
+  }
+#endif
+
+#if defined(__unix__)
+  signal(SIGUSR1, [](int) { heartbeat_pending = 1; });
+  if (opt::checkpoint)
+    signal(SIGTERM, [](int) { terminate_pending = 1; });
+#endif
 
-  std::ifstream ifs(tmfile);
   TMParser parser;
-  auto TM = parser.parseTMFile(ifs);
-  if (!parser.validate_input(input)) { return 1; }
+  auto prog = parser.parseFile(tmfile);
 
-  if (opt::verbose) {
-    /* clang-format off */
-    std::cout << "Input: " << input << "\n";
-    std::cout << "==================== RUN ====================\n";
-    /* clang-format on */
+  if (opt::emit_cpp) {
+    std::ofstream ofs;
+    if (input) ofs.open(input);
+    CppEmitter(*prog, input ? ofs : std::cout).emit(tmfile);
+    return 0;
   }
 
-  TM.set_input(input);
-#ifdef DEBUG
-  TM.dump();
-#endif
-
-#if 1
-  std::string result = TM.run();
-  if (opt::verbose) {
-    /* clang-format off */
-    std::cout << "Result: " << result << "\n";
-    std::cout << "==================== END ====================\n";
-    /* clang-format on */
-  } else {
-    std::cout << result << "\n";
+  switch (opt::tape) {
+  case opt::TAPE_RLE:
+    return runTapes<RleTape>(parser, prog, input);
+  case opt::TAPE_PAGED:
+    return runTapes<PagedTape>(parser, prog, input);
+  case opt::TAPE_PACKED:
+    return runTapes<PackedTape>(parser, prog, input);
+  default: return runTapes<Tape>(parser, prog, input);
   }
-#endif
-  return 0;
 }
@@ -49,6 +49,10 @@ bool validate(const std::string &s) {
 }
 
 TEST(case1) {
+  std::ifstream ifs("programs/case1.tm");
+  TMParser parser;
+  auto TM = parser.parseTMFile(ifs);
+
   for (int i = 0; i < 10000; i++) {
     int a1 = rand() % 5;
     int b1 = rand() % 5;
@@ -60,9 +64,7 @@ TEST(case1) {
     for (int i = 0; i < a2; i++) t.push_back('a');
     for (int i = 0; i < b2; i++) t.push_back('b');
 
-    std::ifstream ifs("programs/case1.tm");
-    TMParser parser;
-    auto TM = parser.parseTMFile(ifs);
+    TM.reset();
     TM.set_input(t);
     std::string result = TM.run();
 
@@ -78,6 +80,10 @@ TEST(case1) {
 }
 
 TEST(case2) {
+  std::ifstream ifs("programs/case1.tm");
+  TMParser parser;
+  auto TM = parser.parseTMFile(ifs);
+
   for (int i = 0; i < 100000; i++) {
     std::string t;
     for (int i = rand() % 10; i >= 0; i --)
@@ -86,9 +92,7 @@ TEST(case2) {
       case 1: t.push_back('b'); break;
       }
 
-    std::ifstream ifs("programs/case1.tm");
-    TMParser parser;
-    auto TM = parser.parseTMFile(ifs);
+    TM.reset();
     TM.set_input(t);
     std::string result = TM.run();
 
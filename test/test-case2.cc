@@ -50,6 +50,10 @@ bool validate(const std::string &s) {
 }
 
 TEST(case2_1) {
+  std::ifstream ifs("programs/case2.tm");
+  TMParser parser;
+  auto TM = parser.parseTMFile(ifs);
+
   for (int a = 1; a < 100; a++) {
     for (int b = 1; b < 100; b++) {
 
@@ -60,9 +64,7 @@ TEST(case2_1) {
       t.push_back('=');
       for (int i = 0; i < a * b; i++) t.push_back('1');
 
-      std::ifstream ifs("programs/case2.tm");
-      TMParser parser;
-      auto TM = parser.parseTMFile(ifs);
+      TM.reset();
       TM.set_input(t);
       std::string result = TM.run();
 
@@ -75,6 +77,10 @@ TEST(case2_1) {
 }
 
 TEST(case2_2) {
+  std::ifstream ifs("programs/case2.tm");
+  TMParser parser;
+  auto TM = parser.parseTMFile(ifs);
+
   for (int a = 1; a < 10; a++) {
     for (int b = 1; b < 10; b++) {
       for (int res = 1; res < 200; res++) {
@@ -86,9 +92,7 @@ TEST(case2_2) {
         t.push_back('=');
         for (int i = 0; i < res; i++) t.push_back('1');
 
-        std::ifstream ifs("programs/case2.tm");
-        TMParser parser;
-        auto TM = parser.parseTMFile(ifs);
+        TM.reset();
         TM.set_input(t);
         std::string result = TM.run();
 
@@ -111,6 +115,10 @@ TEST(case2_2) {
 }
 
 TEST(case2_3) {
+  std::ifstream ifs("programs/case2.tm");
+  TMParser parser;
+  auto TM = parser.parseTMFile(ifs);
+
   for (int i = 0; i < 100000; i++) {
     std::string t;
     for (int i = rand() % 20; i > 0; i--) {
@@ -121,9 +129,7 @@ TEST(case2_3) {
       }
     }
 
-    std::ifstream ifs("programs/case2.tm");
-    TMParser parser;
-    auto TM = parser.parseTMFile(ifs);
+    TM.reset();
     TM.set_input(t);
     std::string result = TM.run();
 
@@ -0,0 +1,179 @@
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+#include "../main.cc"
+
+/* every tape representation must behave like the flat Tape */
+template <class TapeT, class... Args>
+void compareTapes(const char *name, const char *syms,
+    int64_t far, Args &&... args) {
+  Tape ref('_');
+  TapeT t('_', args...);
+
+  for (int i = 0; i < 200000; i++) {
+    char ch = syms[rand() % strlen(syms)];
+    int shift = rand() % 3 - 1;
+    if (rand() % 64 == 0) {
+      int64_t k = rand() % (rand() % 16 ? 100 : far) + 1;
+      /* the flat tape only counts cells in its buffer */
+      ref.ensure(ref.get_index() + (shift ? shift : 1) * k);
+      if constexpr (std::is_same<TapeT, PackedTape>::value)
+        t.ensure(t.get_index() + (shift ? shift : 1) * k);
+      if (ref.runLength(ref.get(), shift ? shift : 1, k) !=
+          t.runLength(t.get(), shift ? shift : 1, k))
+        std::cout << name << ": runLength, fail at " << i
+                  << "\n";
+      if (shift) {
+        ref.fill(ch, shift, k);
+        t.fill(ch, shift, k);
+      }
+    } else {
+      ref.setAndShift(ch, shift);
+      t.setAndShift(ch, shift);
+    }
+
+    if (ref.get() != t.get() ||
+        ref.get_index() != t.get_index())
+      std::cout << name << ": head, fail at " << i << "\n";
+    if (i % 1000 == 0) {
+      if (ref.get_contents() != t.get_contents() ||
+          ref.cbegin() != t.cbegin() ||
+          ref.cend() != t.cend())
+        std::cout << name << ": contents, fail at " << i
+                  << "\n";
+      /* the extent is exact, lazily shrunk or not */
+      std::string c = t.get_contents();
+      if (c.size() && (c.front() == '_' || c.back() == '_'))
+        std::cout << name << ": extent, fail at " << i << "\n";
+      int64_t h = ref.get_index();
+      for (int64_t j = h - 300; j < h + 300; j++)
+        if (ref.get(j) != t.get(j))
+          std::cout << name << ": get, fail at " << i
+                    << "\n";
+    }
+    if (i % 50000 == 0) {
+      ref.clear();
+      t.clear();
+      ref.set(syms + 1);
+      t.set(syms + 1);
+    }
+  }
+}
+
+template <class TapeT>
+void compareRuns(const char *tm, const char *alphabet) {
+  std::ifstream ifs(tm);
+  TMParser parser;
+  auto prog = parser.parseProgram(ifs);
+  TuringMachine ref(prog);
+  BasicTuringMachine<TapeT> TM(prog);
+
+  for (int i = 0; i < 10000; i++) {
+    std::string t;
+    for (int n = rand() % 20; n > 0; n--)
+      t.push_back(alphabet[rand() % strlen(alphabet)]);
+
+    ref.reset();
+    ref.set_input(t);
+    TM.reset();
+    TM.set_input(t);
+    if (ref.run() != TM.run() ||
+        ref.get_steps() != TM.get_steps())
+      std::cout << tm << ": result <> flat, fail at " << t
+                << "\n";
+  }
+}
+
+TEST(case3_rle) {
+  compareTapes<RleTape>("rle", "__ab", 100);
+  compareRuns<RleTape>("programs/case1.tm", "ab");
+  compareRuns<RleTape>("programs/case2.tm", "11x=");
+  compareRuns<RleTape>(
+      "test/palindrome_detector_2tapes.tm", "01");
+}
+
+TEST(case3_paged) {
+  compareTapes<PagedTape>("paged", "__ab", 100);
+  /* far jumps with a 1 MiB cap spill pages to the file */
+  opt::tape_mem = 1;
+  compareTapes<PagedTape>("paged-spill", "__ab", 1 << 20);
+  opt::tape_mem = 0;
+  compareRuns<PagedTape>("programs/case1.tm", "ab");
+  compareRuns<PagedTape>("programs/case2.tm", "11x=");
+  compareRuns<PagedTape>(
+      "test/palindrome_detector_2tapes.tm", "01");
+}
+
+TEST(case3_packed) {
+  /* 1, 2 and 4 bits per cell */
+  const char *machines[] = {
+      "#Q = {q}\n#S = {a}\n#G = {a,_}\n#q0 = q\n#B = _\n"
+      "#F = {q}\n#N = 1\n\n",
+      "#Q = {q}\n#S = {a,b}\n#G = {a,b,_}\n#q0 = q\n"
+      "#B = _\n#F = {q}\n#N = 1\n\n",
+      "#Q = {q}\n#S = {a,b}\n#G = {a,b,c,d,e,_}\n#q0 = q\n"
+      "#B = _\n#F = {q}\n#N = 1\n\n"};
+  const char *syms[] = {"__a", "__ab", "__abcde"};
+  for (int k = 0; k < 3; k++) {
+    std::istringstream is(machines[k]);
+    TMParser parser;
+    auto prog = parser.parseProgram(is);
+    compareTapes<PackedTape>(
+        "packed", syms[k], 100, prog->delta);
+  }
+
+  compareRuns<PackedTape>("programs/case1.tm", "ab");
+  compareRuns<PackedTape>("programs/case2.tm", "11x=");
+  compareRuns<PackedTape>(
+      "test/palindrome_detector_2tapes.tm", "01");
+}
+
+/* the JIT leaves the tapes as the interpreter does, its
+ * written range included */
+void compareJit(const char *tm, const char *alphabet) {
+  std::ifstream ifs(tm);
+  TMParser parser;
+  auto prog = parser.parseProgram(ifs);
+  TuringMachine ref(prog), TM(prog);
+
+  for (int i = 0; i < 10000; i++) {
+    std::string t;
+    for (int n = rand() % 20; n > 0; n--)
+      t.push_back(alphabet[rand() % strlen(alphabet)]);
+
+    ref.reset();
+    ref.set_input(t);
+    std::string expected = ref.run();
+    opt::jit = true;
+    TM.reset();
+    TM.set_input(t);
+    std::string result = TM.run();
+    opt::jit = false;
+    if (result != expected ||
+        ref.get_steps() != TM.get_steps())
+      std::cout << tm << ": jit, fail at " << t << "\n";
+    for (unsigned k = 0; k < prog->nTapes; k++) {
+      const Tape &a = ref.get_tape(k), &b = TM.get_tape(k);
+      if (a.get_contents() != b.get_contents() ||
+          a.begin() != b.begin() || a.end() != b.end())
+        std::cout << tm << ": jit tape, fail at " << t << "\n";
+    }
+  }
+}
+
+TEST(case3_jit) {
+  compareJit("programs/case1.tm", "ab");
+  compareJit("programs/case2.tm", "11x=");
+  compareJit("test/palindrome_detector_2tapes.tm", "01");
+}
@@ -0,0 +1,190 @@
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+#include "../main.cc"
+
+static std::string machine(const char *states,
+    const char *init, const char *delta) {
+  return formatv("#Q = {%s}\n#S = {0,1}\n#G = {0,1,_}\n"
+                 "#q0 = %s\n#B = _\n#F = {h}\n#N = 1\n\n%s",
+      states, init, delta);
+}
+
+TEST(case4_diverges) {
+  const std::pair<std::string, const char *> runs[] = {
+      /* a cycle in place */
+      {machine("a,b,h", "a", "a _ _ * b\nb _ _ * a\n"), ""},
+      /* marching right or left into blanks */
+      {machine("a,h", "a", "a _ 1 r a\na 0 0 r a\na 1 1 r a\n"),
+          "0110"},
+      {machine("a,h", "a", "a _ 1 l a\na 0 0 l a\na 1 1 l a\n"),
+          "0110"},
+      /* a zig-zag leaving 10 behind */
+      {machine("q0,q1,q2,q3,h", "q0",
+           "q0 _ 1 r q1\nq1 _ _ l q2\nq2 1 1 r q3\n"
+           "q3 _ 0 r q0\n"),
+          ""},
+  };
+
+  opt::detect = true;
+  for (const auto &run : runs) {
+    std::istringstream is(run.first);
+    TMParser parser;
+    auto TM = parser.parseTMFile(is);
+    TM.reset();
+    TM.set_input(run.second);
+    TM.run();
+    if (!TM.diverges())
+      std::cout << "not diverging, fail at " << run.first
+                << "\n";
+  }
+  opt::detect = false;
+}
+
+TEST(case4_halts) {
+  const char *tms[] = {"programs/case1.tm",
+      "programs/case2.tm",
+      "test/palindrome_detector_2tapes.tm"};
+  const char *alphabets[] = {"ab", "11x=", "01"};
+
+  for (int k = 0; k < 3; k++) {
+    std::ifstream ifs(tms[k]);
+    TMParser parser;
+    auto TM = parser.parseTMFile(ifs);
+    for (int i = 0; i < 2000; i++) {
+      std::string t;
+      for (int n = rand() % 20; n > 0; n--)
+        t.push_back(
+            alphabets[k][rand() % strlen(alphabets[k])]);
+
+      TM.reset();
+      TM.set_input(t);
+      std::string expected = TM.run();
+      uint64_t steps = TM.get_steps();
+
+      opt::detect = true;
+      TM.reset();
+      TM.set_input(t);
+      std::string result = TM.run();
+      opt::detect = false;
+      if (TM.diverges() || result != expected ||
+          TM.get_steps() != steps)
+        std::cout << tms[k] << ": diverges, fail at " << t
+                  << "\n";
+    }
+  }
+
+  /* eats the 1s from the right, drifting left over cells it
+   * wrote before halting */
+  std::istringstream is(machine("s,a,b,c,h", "s",
+      "s 1 1 r s\ns _ _ l b\na _ _ l b\nb 1 _ l c\n"
+      "c 1 1 r a\n"));
+  TMParser parser;
+  auto TM = parser.parseTMFile(is);
+  opt::detect = true;
+  TM.reset();
+  TM.set_input("11111111");
+  TM.run();
+  opt::detect = false;
+  if (TM.diverges())
+    std::cout << "drift back: diverges, fail\n";
+}
+
+TEST(case4_budgets) {
+  /* a sweep to the right and a loop in place */
+  const std::string loops[] = {
+      machine("a,h", "a", "a _ 1 r a\n"),
+      machine("a,b,h", "a", "a _ 1 * b\nb 1 _ * a\n"),
+  };
+  bool *engines[] = {&opt::skip, &opt::jit, &opt::macro};
+
+  for (const std::string &tm : loops) {
+    std::istringstream is(tm);
+    TMParser parser;
+    auto TM = parser.parseTMFile(is);
+    for (bool *engine : engines) {
+      bool old = *engine;
+      *engine = !old;
+      for (uint64_t n : {1ull, 1000ull, 3000017ull}) {
+        opt::max_steps = n;
+        TM.reset();
+        TM.run();
+        if (TM.get_stop() != TuringMachine::STEP_LIMIT ||
+            TM.get_steps() != n)
+          std::cout << "max-steps, fail at " << n << "\n";
+      }
+
+      /* resumed below its step count, it stops at once */
+      const std::string snap =
+          formatv("/tmp/turing-test-%s.snap", getpid());
+      opt::checkpoint = snap.c_str();
+      TM.reset();
+      TM.run();
+      opt::checkpoint = nullptr;
+      opt::max_steps = 1000;
+      auto resumed = TM;
+      if (!resumed.restore(snap) || (resumed.run(), false) ||
+          resumed.get_stop() != TuringMachine::STEP_LIMIT ||
+          resumed.get_steps() != 3000017)
+        std::cout << "max-steps resumed, fail at " << tm << "\n";
+      unlink(snap.c_str());
+      opt::max_steps = 0;
+
+      opt::timeout = 0.01;
+      TM.reset();
+      TM.run();
+      opt::timeout = 0;
+      if (TM.get_stop() != TuringMachine::TIMEOUT)
+        std::cout << "timeout, fail at " << tm << "\n";
+      *engine = old;
+    }
+  }
+
+  std::istringstream is(loops[0]);
+  TMParser parser;
+  auto TM = parser.parseTMFile(is);
+  opt::max_tape_cells = 1000;
+  TM.reset();
+  TM.run();
+  opt::max_tape_cells = 0;
+  if (TM.get_stop() != TuringMachine::TAPE_LIMIT)
+    std::cout << "max-tape-cells, fail\n";
+
+  /* a run halting right at the limit halts */
+  std::ifstream ifs("programs/case2.tm");
+  TMParser parser2;
+  auto TM2 = parser2.parseTMFile(ifs);
+  for (int i = 0; i < 1000; i++) {
+    std::string t = std::string(rand() % 10 + 1, '1') + "x" +
+                    std::string(rand() % 10 + 1, '1') + "=11";
+    opt::max_steps = 0;
+    TM2.reset();
+    TM2.set_input(t);
+    std::string expected = TM2.run();
+    opt::max_steps = TM2.get_steps();
+    TM2.reset();
+    TM2.set_input(t);
+    std::string result = TM2.run();
+    if (TM2.verdict() || result != expected)
+      std::cout << "max-steps, fail at " << t << "\n";
+
+    opt::max_steps = TM2.get_steps() - 1;
+    TM2.reset();
+    TM2.set_input(t);
+    TM2.run();
+    if (TM2.get_stop() != TuringMachine::STEP_LIMIT)
+      std::cout << "max-steps - 1, fail at " << t << "\n";
+  }
+  opt::max_steps = 0;
+}
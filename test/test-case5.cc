@@ -0,0 +1,439 @@
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "test.h"
+
+#include "../main.cc"
+
+static const std::string snapshot =
+    formatv("/tmp/turing-test-%s.snap", getpid());
+
+/* a run stopped halfway and resumed from its snapshot ends
+ * like the uninterrupted run */
+template <class TapeT>
+void resumeRuns(const char *tm, const char *alphabet) {
+  std::ifstream ifs(tm);
+  TMParser parser;
+  auto prog = parser.parseProgram(ifs);
+  BasicTuringMachine<TapeT> TM(prog);
+
+  for (int i = 0; i < 300; i++) {
+    std::string t;
+    for (int n = rand() % 20; n > 0; n--)
+      t.push_back(alphabet[rand() % strlen(alphabet)]);
+
+    TM.reset();
+    TM.set_input(t);
+    std::string expected = TM.run();
+    uint64_t steps = TM.get_steps();
+    if (steps < 2) continue;
+
+    opt::max_steps = steps / 2;
+    opt::checkpoint = snapshot.c_str();
+    TM.reset();
+    TM.set_input(t);
+    TM.run();
+    opt::max_steps = 0;
+    opt::checkpoint = nullptr;
+
+    BasicTuringMachine<TapeT> resumed(prog);
+    if (!resumed.restore(snapshot) ||
+        resumed.get_steps() != steps / 2 ||
+        resumed.run() != expected ||
+        resumed.get_steps() != steps || resumed.verdict())
+      std::cout << tm << ": resumed, fail at " << t << "\n";
+  }
+}
+
+TEST(case5_resume) {
+  resumeRuns<Tape>("programs/case1.tm", "ab");
+  resumeRuns<Tape>("programs/case2.tm", "11x=");
+  resumeRuns<Tape>("test/palindrome_detector_2tapes.tm", "01");
+  resumeRuns<RleTape>("programs/case2.tm", "11x=");
+  resumeRuns<PagedTape>("programs/case2.tm", "11x=");
+  resumeRuns<PackedTape>("programs/case2.tm", "11x=");
+}
+
+/* the debugger reaches every step with the configuration of
+ * a run stepped straight to it */
+void debugRuns(const char *tm, const char *alphabet) {
+  std::ifstream ifs(tm);
+  TMParser parser;
+  auto TM = parser.parseTMFile(ifs);
+
+  for (int i = 0; i < 100; i++) {
+    std::string t;
+    for (int n = rand() % 20; n > 0; n--)
+      t.push_back(alphabet[rand() % strlen(alphabet)]);
+
+    std::vector<Configuration> configs(1);
+    TM.reset();
+    TM.set_input(t);
+    TM.get_config(configs[0]);
+    while (TM.takeStep() != TransitionTable::npos) {
+      configs.emplace_back();
+      TM.get_config(configs.back());
+      if (TM.get_program().delta.stopsAt(TM.get_state()))
+        break;
+    }
+
+    TM.reset();
+    TM.set_input(t);
+    Debugger<Tape> dbg(TM, 7);
+    for (int k = 0; k < 50; k++) {
+      switch (rand() % 3) {
+      case 0: dbg.goTo(rand() % (configs.size() + 10)); break;
+      case 1: dbg.forward(); break;
+      default: dbg.back(); break;
+      }
+      Configuration c;
+      TM.get_config(c);
+      if (c.steps >= configs.size() ||
+          !c.sameAs(configs[c.steps]))
+        std::cout << tm << ": debugger, fail at " << t
+                  << "\n";
+    }
+
+    /* the first step after 0 in the final state */
+    Debugger<Tape>::Condition final;
+    final.state = configs.back().state;
+    size_t first = 1;
+    while (first < configs.size() &&
+           configs[first].state != final.state)
+      first++;
+    dbg.goTo(0);
+    bool found = dbg.runUntil(final, false);
+    if (found != (first < configs.size()) ||
+        (found && TM.get_steps() != first))
+      std::cout << tm << ": until, fail at " << t << "\n";
+  }
+}
+
+TEST(case5_debugger) {
+  debugRuns("programs/case1.tm", "ab");
+  debugRuns("programs/case2.tm", "11x=");
+  debugRuns("test/palindrome_detector_2tapes.tm", "01");
+
+  /* long runs go in batches with sweeps skipped, and stop
+   * where stepping one at a time stops */
+  std::istringstream is(
+      "#Q = {a,b,h}\n#S = {0,1}\n#G = {0,1,_}\n#q0 = a\n"
+      "#B = _\n#F = {h}\n#N = 1\n\n"
+      "a 1 1 r a\na _ 1 l b\nb 1 1 l b\nb _ _ r a\n");
+  TMParser parser;
+  auto TM = parser.parseTMFile(is);
+  auto ref = TM;
+  TM.reset();
+  Debugger<Tape> dbg(TM, 1 << 16);
+  auto same = [&TM, &ref]() {
+    Configuration a, b;
+    TM.get_config(a);
+    ref.get_config(b);
+    return a.steps == b.steps && a.sameAs(b);
+  };
+  auto stepTo = [&ref](uint64_t n) {
+    ref.reset();
+    while (ref.get_steps() < n) ref.takeStep();
+  };
+
+  dbg.goTo(3000000);
+  stepTo(3000000);
+  if (!same()) std::cout << "debugger goto, fail\n";
+  for (int k = 0; k < 20; k++) {
+    Debugger<Tape>::Condition c;
+    if (k % 2)
+      c.sym = k % 3 ? '_' : '1';
+    else
+      c.state = k % 4 ? 0 : 1;
+    dbg.runUntil(c, false);
+    do
+      ref.takeStep();
+    while (c.sym ? ref.get_tape(0).get() != c.sym
+                 : ref.get_state() != c.state);
+    if (!same()) std::cout << "debugger until, fail at " << k << "\n";
+  }
+  uint64_t n = TM.get_steps();
+  for (int k = 0; k < 3; k++) dbg.back();
+  stepTo(n - 3);
+  if (!same()) std::cout << "debugger back, fail\n";
+  dbg.goTo(1234567);
+  stepTo(1234567);
+  if (!same()) std::cout << "debugger goto back, fail\n";
+}
+
+/* everything a run prints to std::cout */
+template <class F>
+std::string captured(F f) {
+  std::ostringstream oss;
+  std::streambuf *old = std::cout.rdbuf(oss.rdbuf());
+  f();
+  std::cout.rdbuf(old);
+  return oss.str();
+}
+
+/* a rendered trace reads like the verbose run */
+TEST(case5_trace) {
+  const char *tm = "programs/case2.tm";
+  const std::string trace = snapshot + ".trace";
+  std::ifstream ifs(tm);
+  TMParser parser;
+  auto prog = parser.parseProgram(ifs);
+  TuringMachine TM(prog);
+
+  for (int i = 0; i < 100; i++) {
+    std::string t = std::string(rand() % 5 + 1, '1') + "x" +
+                     std::string(rand() % 5 + 1, '1') + "=1";
+    std::string expected = captured([&]() {
+      opt::verbose = true;
+      TM.reset();
+      TM.set_input(t);
+      TM.run();
+      opt::verbose = false;
+    });
+
+    TraceWriter w(rand() % 20 + 1);
+    w.open(trace.c_str(), prog->fingerprint(), prog->nTapes);
+    TM.set_trace(&w);
+    TM.reset();
+    TM.set_input(t);
+    TM.run();
+    TM.set_trace(nullptr);
+    w.finish();
+
+    const char *argv[] = {
+        "turing-trace", tm, trace.c_str(), nullptr};
+    std::string result =
+        captured([&]() { traceMain(3, argv); });
+    if (result != expected)
+      std::cout << "trace, fail at " << t << "\n";
+  }
+  unlink(trace.c_str());
+}
+
+TEST(case5_long) {
+  /* sweeps back and forth over a growing block of 1s */
+  std::istringstream is(
+      "#Q = {a,b,h}\n#S = {0,1}\n#G = {0,1,_}\n#q0 = a\n"
+      "#B = _\n#F = {h}\n#N = 1\n\n"
+      "a 1 1 r a\na _ 1 l b\nb 1 1 l b\nb _ _ r a\n");
+  TMParser parser;
+  auto TM = parser.parseTMFile(is);
+
+  opt::max_steps = 6000000;
+  TM.reset();
+  std::string expected = TM.run();
+
+  opt::max_steps = 3000000;
+  opt::checkpoint = snapshot.c_str();
+  TM.reset();
+  TM.run();
+  opt::checkpoint = nullptr;
+
+  opt::max_steps = 6000000;
+  auto resumed = TM;
+  if (!resumed.restore(snapshot) || resumed.run() != expected ||
+      resumed.get_stop() != TuringMachine::STEP_LIMIT)
+    std::cout << "long run resumed, fail\n";
+  opt::max_steps = 0;
+
+  /* snapshots belong to one program */
+  std::ifstream ifs("programs/case1.tm");
+  TMParser parser2;
+  auto other = parser2.parseTMFile(ifs);
+  if (other.restore(snapshot))
+    std::cout << "restored onto another program, fail\n";
+  unlink(snapshot.c_str());
+}
+
+/* profiled runs count each transition as often as plain
+ * stepping takes it, sweeps included */
+TEST(case5_profile) {
+  std::istringstream is(
+      "#Q = {a,b,h}\n#S = {0,1}\n#G = {0,1,_}\n#q0 = a\n"
+      "#B = _\n#F = {h}\n#N = 1\n\n"
+      "a 1 1 r a\na _ 1 l b\nb 1 1 l b\nb _ _ r a\n");
+  TMParser parser;
+  auto prog = parser.parseProgram(is);
+  TuringMachine TM(prog);
+  Profiler profiler(*prog);
+  TM.set_profile(&profiler);
+
+  for (uint64_t limit : {1000, 1000000, 3000001}) {
+    std::vector<uint64_t> expected(prog->delta.size());
+    TM.reset();
+    for (uint64_t k = 0; k < limit; k++)
+      expected[TM.takeStep()]++;
+
+    std::fill(profiler.hits.begin(), profiler.hits.end(), 0);
+    opt::max_steps = limit;
+    TM.reset();
+    TM.run();
+    opt::max_steps = 0;
+    if (profiler.hits != expected)
+      std::cout << "profile, fail at " << limit << "\n";
+  }
+
+  std::ostringstream json;
+  profiler.writeJson(json);
+  if (json.str().find("\"steps\": 3000001,") ==
+      std::string::npos)
+    std::cout << "profile report, fail\n";
+}
+
+/* sweeps skipped at once count like the steps they stand for,
+ * the long run makes the buckets coarsen */
+TEST(case5_heatmap) {
+  std::istringstream is(
+      "#Q = {a,b,h}\n#S = {0,1}\n#G = {0,1,_}\n#q0 = a\n"
+      "#B = _\n#F = {h}\n#N = 1\n\n"
+      "a 1 1 r a\na _ 1 l b\nb 1 1 l b\nb _ _ r a\n");
+  TMParser parser;
+  auto prog = parser.parseProgram(is);
+
+  for (uint64_t limit : {1000, 40000000}) {
+    TapeHeat heat[2];
+    for (int skip = 0; skip < 2; skip++) {
+      BasicTuringMachine<HeatTape<Tape>> TM(prog);
+      opt::skip = skip;
+      opt::max_steps = limit;
+      TM.reset();
+      TM.run();
+      heat[skip] = TM.get_tape(0).heat();
+    }
+    opt::skip = 1;
+    opt::max_steps = 0;
+
+    const TapeHeat &a = heat[0], &b = heat[1];
+    if (a.buckets != b.buckets || a.shift != b.shift ||
+        a.first != b.first || a.visits != b.visits ||
+        a.moves != limit || b.moves != limit ||
+        a.reversals != b.reversals ||
+        !std::equal(a.sweeps, a.sweeps + 64, b.sweeps) ||
+        a.buckets.size() > TapeHeat::max_buckets ||
+        (limit > 1000 && !a.shift))
+      std::cout << "heatmap, fail at " << limit << "\n";
+  }
+
+  /* three tapes, the heads of some stay put while another
+   * one sweeps */
+  std::ifstream ifs("programs/case2.tm");
+  TMParser parser2;
+  auto prog2 = parser2.parseProgram(ifs);
+  const std::string input = std::string(30, '1') + "x" +
+                            std::string(40, '1') + "=" +
+                            std::string(1200, '1');
+  std::vector<TapeHeat> heat[2];
+  for (int skip = 0; skip < 2; skip++) {
+    BasicTuringMachine<HeatTape<Tape>> TM(prog2);
+    opt::skip = skip;
+    TM.reset();
+    TM.set_input(input);
+    TM.run();
+    for (unsigned i = 0; i < prog2->nTapes; i++)
+      heat[skip].push_back(TM.get_tape(i).heat());
+  }
+  opt::skip = 1;
+  for (unsigned i = 0; i < prog2->nTapes; i++) {
+    const TapeHeat &a = heat[0][i], &b = heat[1][i];
+    if (a.buckets != b.buckets || a.first != b.first ||
+        a.visits != b.visits || a.moves != b.moves ||
+        a.reversals != b.reversals)
+      std::cout << "heatmap case2, fail at tape " << i << "\n";
+  }
+}
+
+/* generated machines parse and do what they are made for */
+TEST(case5_tmgen) {
+  auto parsed = [](const std::function<void(TMGenerator &)> &f) {
+    std::ostringstream os;
+    TMGenerator gen(os);
+    f(gen);
+    std::istringstream is(os.str());
+    TMParser parser;
+    return parser.parseTMFile(is);
+  };
+
+  for (unsigned k = 2; k <= 4; k++) {
+    auto TM = parsed([k](TMGenerator &g) { g.copy(k, true); });
+    for (const char *t : {"", "0", "0110", "10101", "0111"}) {
+      std::string s = t;
+      TM.reset();
+      TM.set_input(s);
+      TM.run();
+      const Program &prog = TM.get_program();
+      bool accepts = prog.stateStrings[TM.get_state()] == "h";
+      if (accepts != std::equal(s.begin(), s.end(), s.rbegin()))
+        std::cout << "compare " << k << ", fail at " << t << "\n";
+    }
+  }
+
+  auto chain = parsed([](TMGenerator &g) { g.chain(1000); });
+  chain.reset();
+  chain.set_input("0110");
+  if (chain.run() != "1001" + std::string(996, '1') ||
+      chain.get_steps() != 1000)
+    std::cout << "states, fail\n";
+
+  auto counter = parsed([](TMGenerator &g) { g.binaryCounter(8); });
+  counter.reset();
+  if (counter.run() != "00000000" ||
+      counter.get_steps() < (1 << 8))
+    std::cout << "binary counter, fail\n";
+
+  auto unary = parsed([](TMGenerator &g) { g.unaryCounter(100); });
+  unary.reset();
+  if (unary.run() != "" || unary.get_steps() < 100 * 100 / 2)
+    std::cout << "unary counter, fail\n";
+
+  std::ostringstream a, b;
+  TMGenerator(a).random(20, 3, 2, 7);
+  TMGenerator(b).random(20, 3, 2, 7);
+  auto random = parsed(
+      [](TMGenerator &g) { g.random(20, 3, 2, 7); });
+  if (a.str() != b.str() ||
+      random.get_program().delta.size() != 20 * 4 * 4)
+    std::cout << "random, fail\n";
+}
+
+/* a mapped file parses like the same text read from a stream */
+TEST(case5_parse_file) {
+  for (const char *tm :
+      {"programs/case1.tm", "programs/case2.tm",
+          "test/palindrome_detector_2tapes.tm"}) {
+    std::ifstream ifs(tm);
+    TMParser streamed, mapped;
+    auto a = streamed.parseProgram(ifs);
+    auto b = mapped.parseFile(tm);
+    if (a->fingerprint() != b->fingerprint() ||
+        a->stateStrings != b->stateStrings ||
+        a->inputSymbols != b->inputSymbols)
+      std::cout << tm << ": mapped, fail\n";
+  }
+}
+
+/* transitions parsed in chunks on several threads compile to
+ * the program of a sequential parse */
+TEST(case5_parse_threads) {
+  std::ostringstream os;
+  TMGenerator(os).chain(60000);
+  std::shared_ptr<const Program> progs[2];
+  for (unsigned k = 0; k < 2; k++) {
+    std::istringstream is(os.str());
+    TMParser parser;
+    parser.threads = k ? 4 : 1;
+    progs[k] = parser.parseProgram(is);
+  }
+  if (progs[0]->fingerprint() != progs[1]->fingerprint() ||
+      progs[0]->stateStrings != progs[1]->stateStrings ||
+      progs[1]->delta.size() != 3 * 60000)
+    std::cout << "parse threads, fail\n";
+}